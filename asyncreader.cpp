@@ -0,0 +1,241 @@
+#include "asyncreader.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <linux/io_uring.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+static int ringSetup(unsigned entries, io_uring_params *p) {
+    return syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int ringEnter(int fd, unsigned submit, unsigned minComplete, unsigned flags) {
+    return syscall(__NR_io_uring_enter, fd, submit, minComplete, flags, nullptr, 0);
+}
+
+static unsigned *at(void *base, uint32_t off) {
+    return reinterpret_cast<unsigned *>(static_cast<char *>(base) + off);
+}
+
+asyncreader::asyncreader(unsigned depth) {
+    if (!setup(depth))
+        teardown(); // 退回同步读
+}
+
+asyncreader::~asyncreader() {
+    wait();
+    teardown();
+}
+
+asyncreader &asyncreader::local() {
+    thread_local asyncreader reader;
+    return reader;
+}
+
+bool asyncreader::setup(unsigned depth) {
+    io_uring_params p;
+    std::memset(&p, 0, sizeof(p));
+    ringFd = ringSetup(depth, &p);
+    if (ringFd < 0)
+        return false;
+    entries    = p.sq_entries;
+    sqRingSize = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    cqRingSize = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+    bool single = p.features & IORING_FEAT_SINGLE_MMAP; // 两个队列共用一次映射
+    if (single)
+        sqRingSize = cqRingSize = std::max(sqRingSize, cqRingSize);
+    sqRing = mmap(nullptr, sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_SQ_RING);
+    if (sqRing == MAP_FAILED) {
+        sqRing = nullptr;
+        return false;
+    }
+    cqRing = single ? sqRing
+                    : mmap(nullptr, cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd,
+                           IORING_OFF_CQ_RING);
+    if (cqRing == MAP_FAILED) {
+        cqRing = nullptr;
+        return false;
+    }
+    void *s = mmap(nullptr, p.sq_entries * sizeof(io_uring_sqe), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                   ringFd, IORING_OFF_SQES);
+    if (s == MAP_FAILED)
+        return false;
+    sqes    = static_cast<io_uring_sqe *>(s);
+    sqHead  = at(sqRing, p.sq_off.head);
+    sqTail  = at(sqRing, p.sq_off.tail);
+    sqMask  = at(sqRing, p.sq_off.ring_mask);
+    sqArray = at(sqRing, p.sq_off.array);
+    cqHead  = at(cqRing, p.cq_off.head);
+    cqTail  = at(cqRing, p.cq_off.tail);
+    cqMask  = at(cqRing, p.cq_off.ring_mask);
+    cqes    = reinterpret_cast<io_uring_cqe *>(static_cast<char *>(cqRing) + p.cq_off.cqes);
+    return true;
+}
+
+void asyncreader::teardown() {
+    if (sqes)
+        munmap(sqes, entries * sizeof(io_uring_sqe));
+    if (cqRing && cqRing != sqRing)
+        munmap(cqRing, cqRingSize);
+    if (sqRing)
+        munmap(sqRing, sqRingSize);
+    if (ringFd >= 0)
+        close(ringFd);
+    sqes   = nullptr;
+    sqRing = cqRing = nullptr;
+    ringFd = -1;
+}
+
+void asyncreader::read(int fd, uint64_t offset, uint32_t len, char *buf, callback cb) {
+    request r{fd, offset, len, 0, buf, std::move(cb)};
+    if (usingRing())
+        readCached(r);
+    else
+        readSync(r);
+    if (r.done == r.len || !usingRing()) { // 不用等设备，趁 buf 还热着就回调
+        r.cb(r.done == r.len);
+        return;
+    }
+    unsigned id;
+    if (idle.empty()) {
+        id = slots.size();
+        slots.emplace_back();
+    } else {
+        id = idle.back();
+        idle.pop_back();
+    }
+    slots[id] = std::move(r);
+    queued.push_back(id);
+}
+
+void asyncreader::readCached(request &r) {
+    while (nowait && r.done < r.len) {
+        iovec iov{r.buf + r.done, r.len - r.done};
+        ssize_t n = ::preadv2(r.fd, &iov, 1, r.offset + r.done, RWF_NOWAIT);
+        if (n < 0 && errno == EOPNOTSUPP)
+            nowait = false;
+        if (n <= 0) // EAGAIN：要等设备，交给 io_uring
+            return;
+        r.done += n;
+    }
+}
+
+void asyncreader::readSync(request &r) {
+    while (r.done < r.len) {
+        ssize_t n = ::pread(r.fd, r.buf + r.done, r.len - r.done, r.offset + r.done);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return;
+        r.done += n;
+    }
+}
+
+void asyncreader::finish(unsigned id, bool ok) {
+    callback cb = std::move(slots[id].cb);
+    idle.push_back(id);
+    cb(ok); // 回调里可以再排队新的请求
+}
+
+unsigned asyncreader::fill() {
+    unsigned tail = *sqTail, head = __atomic_load_n(sqHead, __ATOMIC_ACQUIRE), added = 0;
+    while (!queued.empty() && inflight < entries && tail - head < entries) {
+        unsigned id    = queued.back();
+        request &r     = slots[id];
+        unsigned index = tail & *sqMask;
+        io_uring_sqe *sqe = &sqes[index];
+        std::memset(sqe, 0, sizeof(*sqe));
+        sqe->opcode    = IORING_OP_READ;
+        sqe->fd        = r.fd;
+        sqe->off       = r.offset + r.done;
+        sqe->addr      = reinterpret_cast<uint64_t>(r.buf + r.done);
+        sqe->len       = r.len - r.done;
+        sqe->user_data = id;
+        sqArray[index] = index;
+        queued.pop_back();
+        tail++;
+        added++;
+        inflight++;
+    }
+    __atomic_store_n(sqTail, tail, __ATOMIC_RELEASE);
+    return added;
+}
+
+void asyncreader::complete(unsigned id, int res) {
+    request &r = slots[id];
+    if (res == -EINTR || res == -EAGAIN) { // 重新提交
+        queued.push_back(id);
+        return;
+    }
+    if (res == -EINVAL || res == -EOPNOTSUPP) { // 老内核没有 IORING_OP_READ
+        readSync(r);
+        finish(id, r.done == r.len);
+        return;
+    }
+    if (res <= 0) {
+        finish(id, false);
+        return;
+    }
+    r.done += res;
+    if (r.done < r.len) { // 短读，接着读剩下的
+        queued.push_back(id);
+        return;
+    }
+    finish(id, true);
+}
+
+void asyncreader::wait() {
+    while (!queued.empty() || inflight) {
+        unsigned submit = fill();
+        if (ringEnter(ringFd, submit, 1, IORING_ENTER_GETEVENTS) < 0 && errno != EINTR && errno != EAGAIN &&
+            errno != EBUSY) {
+            std::cerr << "Error: io_uring_enter failed: " << strerror(errno) << std::endl;
+            drain();
+            return;
+        }
+        reap();
+    }
+}
+
+unsigned asyncreader::reap() {
+    unsigned head = *cqHead, tail = __atomic_load_n(cqTail, __ATOMIC_ACQUIRE), n = tail - head;
+    for (; head != tail; ++head) { // 回调里只会排队新请求，不会碰完成队列
+        const io_uring_cqe &cqe = cqes[head & *cqMask];
+        inflight--;
+        complete(cqe.user_data, cqe.res);
+    }
+    __atomic_store_n(cqHead, head, __ATOMIC_RELEASE);
+    return n;
+}
+
+/*
+ * io_uring_enter 出错之后：内核还没取走的提交收回来重新排队；已经取走的读还会写 buf，
+ * 必须等它们的完成事件到齐才能回调，之后拆掉 ring，剩下的请求都用同步 pread 读完。
+ */
+void asyncreader::drain() {
+    unsigned head = __atomic_load_n(sqHead, __ATOMIC_ACQUIRE), tail = *sqTail;
+    for (unsigned i = head; i != tail; ++i) {
+        queued.push_back(sqes[sqArray[i & *sqMask]].user_data);
+        inflight--;
+    }
+    __atomic_store_n(sqTail, head, __ATOMIC_RELEASE);
+    while (inflight) {
+        if (reap())
+            continue;
+        if (ringEnter(ringFd, 0, 1, IORING_ENTER_GETEVENTS) < 0 && errno != EINTR)
+            sched_yield(); // 等不了就轮询完成队列，完成事件不需要 enter 也会写进来
+    }
+    teardown();
+    while (!queued.empty()) { // 回调里新的请求直接同步读，不再排队
+        unsigned id = queued.back();
+        queued.pop_back();
+        readSync(slots[id]);
+        finish(id, slots[id].done == slots[id].len);
+    }
+}
@@ -0,0 +1,79 @@
+#pragma once
+
+#ifndef LSM_KV_ASYNCREADER_H
+#define LSM_KV_ASYNCREADER_H
+
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+const unsigned ASYNC_QUEUE_DEPTH = 64; // 每个线程同时在途的读请求数
+
+struct io_uring_sqe;
+struct io_uring_cqe;
+
+/*
+ * 异步读：用 io_uring 同时提交多个 pread，一次等待全部完成。
+ * 已经在页缓存里的数据先用 RWF_NOWAIT 直接读出来，只有要等设备的读才进 io_uring。
+ * 内核不支持或者被禁止时（io_uring_setup 失败）退回同步 pread，接口不变；之后 io_uring_enter 出错也一样。
+ * 每个线程一个实例（local()），不能跨线程共用。
+ * 回调在 read() 或 wait() 里、当前线程上执行；buf 和 fd 在回调之前必须一直有效。
+ */
+class asyncreader {
+public:
+    typedef std::function<void(bool ok)> callback; // ok 为 true 表示读满了 len 字节
+
+private:
+    struct request {
+        int fd;
+        uint64_t offset;
+        uint32_t len, done; // done: 已经读到的字节数，短读时接着读剩下的
+        char *buf;
+        callback cb;
+    };
+
+    int ringFd = -1;
+    unsigned entries = 0;
+    bool nowait      = true; // 文件系统不支持 RWF_NOWAIT 时关掉
+
+    // 提交队列和完成队列，都映射自内核
+    void *sqRing = nullptr, *cqRing = nullptr;
+    size_t sqRingSize = 0, cqRingSize = 0;
+    unsigned *sqHead, *sqTail, *sqMask, *sqArray;
+    unsigned *cqHead, *cqTail, *cqMask;
+    io_uring_sqe *sqes = nullptr;
+    io_uring_cqe *cqes = nullptr;
+
+    std::vector<request> slots;   // 在途和排队的请求，user_data 是下标
+    std::vector<unsigned> idle;   // 空闲的 slots 下标
+    std::vector<unsigned> queued; // 已经排队、还没放进提交队列的请求
+    unsigned inflight = 0;        // 已经提交、还没完成的请求
+
+    bool setup(unsigned depth);
+    void teardown();
+    unsigned fill();           // 把排队的请求放进提交队列，返回放入的个数
+    unsigned reap();           // 处理完成队列里已有的事件，返回个数
+    void complete(unsigned id, int res);
+    void finish(unsigned id, bool ok);
+    void readSync(request &r);   // 没有 io_uring 时的同步读
+    void readCached(request &r); // 只读页缓存里已有的部分，不阻塞
+    void drain();                // 出错后等在途的读完成，拆掉 ring，其余请求同步读完
+
+public:
+    explicit asyncreader(unsigned depth = ASYNC_QUEUE_DEPTH);
+    ~asyncreader();
+
+    asyncreader(const asyncreader &)            = delete;
+    asyncreader &operator=(const asyncreader &) = delete;
+
+    static asyncreader &local(); // 当前线程的实例
+
+    bool usingRing() const { // false 表示退回了同步读
+        return ringFd >= 0;
+    }
+
+    void read(int fd, uint64_t offset, uint32_t len, char *buf, callback cb); // 能立刻读完就直接回调，否则排队
+    void wait(); // 提交所有排队的请求，等到全部完成
+};
+
+#endif // LSM_KV_ASYNCREADER_H
@@ -0,0 +1,165 @@
+#include "block.h"
+
+#include <cstring>
+
+void putVarint(std::string &dst, uint64_t v) {
+    while (v >= 0x80) {
+        dst.push_back((char)(v | 0x80));
+        v >>= 7;
+    }
+    dst.push_back((char)v);
+}
+
+const char *getVarint(const char *p, const char *limit, uint64_t &v) {
+    v = 0;
+    for (int shift = 0; shift <= 63 && p < limit; shift += 7) {
+        uint64_t byte = (unsigned char)*p++;
+        v |= (byte & 0x7f) << shift;
+        if (!(byte & 0x80))
+            return p;
+    }
+    return nullptr;
+}
+
+void blockbuilder::add(uint64_t key, const std::string &val) {
+    if (counter == 0 || counter >= RESTART_INTERVAL) { // 重启点保存完整的 key
+        restarts.push_back(rep.size());
+        putVarint(rep, key);
+        counter = 0;
+    } else
+        putVarint(rep, key - lastKey);
+    putVarint(rep, val.length());
+    rep.append(val);
+    lastKey = key;
+    counter++;
+}
+
+const std::string &blockbuilder::finish() {
+    for (uint32_t r : restarts)
+        rep.append(reinterpret_cast<const char *>(&r), 4);
+    uint32_t n = restarts.size();
+    rep.append(reinterpret_cast<const char *>(&n), 4);
+    return rep;
+}
+
+void blockbuilder::reset() {
+    rep.clear();
+    restarts.clear();
+    lastKey = 0;
+    counter = 0;
+}
+
+blockiter::blockiter(std::string_view block) : data(block.data()) {
+    numRestarts = 0;
+    if (block.size() >= 4)
+        std::memcpy(&numRestarts, data + block.size() - 4, 4);
+    if (block.size() < 4 + 4 * (uint64_t)numRestarts) { // 损坏的块当作空块
+        numRestarts = 0;
+        limit       = 0;
+    } else
+        limit = block.size() - 4 - 4 * numRestarts;
+    restarts = data + limit;
+}
+
+uint32_t blockiter::restartOffset(uint32_t i) const {
+    uint32_t off;
+    std::memcpy(&off, restarts + 4 * i, 4);
+    return off;
+}
+
+uint64_t blockiter::restartKey(uint32_t i) const {
+    uint64_t key = 0;
+    getVarint(data + restartOffset(i), data + limit, key);
+    return key;
+}
+
+bool blockiter::parse() {
+    cur = nxt;
+    if (cur >= limit)
+        return ok = false;
+    uint64_t base = curKey;
+    if (nextRestart < numRestarts && restartOffset(nextRestart) == cur) { // 重启点上是完整的 key
+        base = 0;
+        nextRestart++;
+    }
+    const char *p = data + cur, *end = data + limit;
+    uint64_t delta, len;
+    p = getVarint(p, end, delta);
+    if (p)
+        p = getVarint(p, end, len);
+    if (!p || len > (uint64_t)(end - p))
+        return ok = false;
+    curKey = base + delta;
+    valOff = p - data;
+    valLen = len;
+    nxt    = valOff + valLen;
+    return ok = true;
+}
+
+void blockiter::seekToFirst() {
+    nxt         = 0;
+    nextRestart = 0;
+    parse();
+}
+
+void blockiter::seekToLast() {
+    if (!numRestarts) {
+        ok = false;
+        return;
+    }
+    nxt         = restartOffset(numRestarts - 1);
+    nextRestart = numRestarts - 1;
+    parse();
+    while (ok && nxt < limit)
+        parse();
+}
+
+void blockiter::seek(uint64_t key) {
+    if (!numRestarts) {
+        ok = false;
+        return;
+    }
+    if (ok && curKey <= key && (nextRestart >= numRestarts || restartKey(nextRestart) > key)) {
+        while (ok && curKey < key) // 目标在当前记录和下一个重启点之间，接着往后读
+            parse();
+        return;
+    }
+    uint32_t lo = 0, hi = numRestarts - 1; // 最后一个 key <= 目标的重启点
+    while (lo < hi) {
+        uint32_t mid = (lo + hi + 1) / 2;
+        if (restartKey(mid) <= key)
+            lo = mid;
+        else
+            hi = mid - 1;
+    }
+    nxt         = restartOffset(lo);
+    nextRestart = lo;
+    parse();
+    while (ok && curKey < key)
+        parse();
+}
+
+void blockiter::next() {
+    parse();
+}
+
+void blockiter::prev() {
+    uint32_t target = cur; // 要找的是下一条记录在 target 的那一条
+    if (!ok || !target) {
+        ok = false;
+        return;
+    }
+    uint32_t lo = 0, hi = numRestarts - 1; // 最后一个在 target 之前的重启点
+    while (lo < hi) {
+        uint32_t mid = (lo + hi + 1) / 2;
+        if (restartOffset(mid) < target)
+            lo = mid;
+        else
+            hi = mid - 1;
+    }
+    nxt         = restartOffset(lo);
+    nextRestart = lo;
+    parse();
+    while (ok && nxt < target)
+        parse();
+}
@@ -0,0 +1,88 @@
+#pragma once
+
+#ifndef LSM_KV_BLOCK_H
+#define LSM_KV_BLOCK_H
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+const uint32_t DATA_BLOCK_SIZE  = 4096; // 数据块写满这么多字节就切块（单个大 value 可以超过）
+const uint32_t RESTART_INTERVAL = 16;   // 每隔多少条记录放一个重启点
+
+void putVarint(std::string &dst, uint64_t v);
+const char *getVarint(const char *p, const char *limit, uint64_t &v); // 数据损坏时返回 nullptr
+
+/*
+ * v2 sstable 的数据块格式:
+ * | { keyDelta(varint) | valueLen(varint) | value } * n | restart(4) * r | r(4) |
+ * 重启点上的 keyDelta 是完整的 key，其余是和上一条 key 的差值。
+ */
+class blockbuilder {
+private:
+    std::string rep;
+    std::vector<uint32_t> restarts;
+    uint64_t lastKey = 0;
+    uint32_t counter = 0; // 距离上一个重启点的记录数
+
+public:
+    void add(uint64_t key, const std::string &val); // key 必须递增
+    const std::string &finish();                    // 补上重启点数组，返回整个块
+    void reset();
+
+    size_t size() const { // finish 之后的大小
+        return rep.size() + 4 * restarts.size() + 4;
+    }
+
+    bool empty() const {
+        return rep.empty();
+    }
+};
+
+// 遍历一个数据块，块的内容由调用者保证在迭代期间有效
+class blockiter {
+private:
+    const char *data;
+    uint32_t limit;       // 重启点数组的起始位置，也就是记录区的结束位置
+    const char *restarts; // 重启点数组
+    uint32_t numRestarts;
+
+    uint32_t cur = 0, nxt = 0; // 当前记录和下一条记录的位置
+    uint32_t nextRestart = 0;  // nxt 之后（含）的第一个重启点
+    uint64_t curKey      = 0;
+    uint32_t valOff = 0, valLen = 0;
+    bool ok = false;
+
+    bool parse(); // 解析 nxt 处的记录
+
+    uint32_t restartOffset(uint32_t i) const;
+    uint64_t restartKey(uint32_t i) const;
+
+public:
+    blockiter(std::string_view block);
+
+    void seekToFirst();
+    void seekToLast();
+    void seek(uint64_t key); // 第一个 >= key 的记录，向后不远时从当前位置接着读
+    void next();
+    void prev(); // 从前一个重启点往后读到当前记录之前
+
+    bool valid() const {
+        return ok;
+    }
+
+    uint64_t key() const {
+        return curKey;
+    }
+
+    std::string value() const {
+        return std::string(data + valOff, valLen);
+    }
+
+    std::string_view valueView() const { // 指向块的内容，不复制
+        return std::string_view(data + valOff, valLen);
+    }
+};
+
+#endif // LSM_KV_BLOCK_H
@@ -0,0 +1,90 @@
+#include "blockcache.h"
+
+blockcache::blockcache(size_t capacity, int shardBits) :
+    shards(1 << shardBits), hits(0), misses(0), inserts(0), evictions(0) {
+    setCapacity(capacity);
+}
+
+blockcache::shard &blockcache::shardOf(uint64_t file, uint64_t offset) {
+    size_t h = blockKeyHash()(blockKey{file, offset});
+    return shards[(h * 0x9e3779b97f4a7c15ull) >> 32 & (shards.size() - 1)];
+}
+
+void blockcache::shard::evict(size_t need, std::atomic<uint64_t> &evictions) {
+    while (usage + need > capacity && (!lru.empty() || !high.empty())) {
+        std::list<entry> &from = lru.empty() ? high : lru; // 先淘汰普通块
+        const entry &victim    = from.back();
+        usage -= victim.block->size();
+        table.erase(blockKey{victim.file, victim.offset});
+        from.pop_back();
+        evictions++;
+    }
+}
+
+blockHandle blockcache::lookup(uint64_t file, uint64_t offset) {
+    shard &sh = shardOf(file, offset);
+    std::lock_guard<std::mutex> lock(sh.mtx);
+    auto it = sh.table.find(blockKey{file, offset});
+    if (it == sh.table.end()) {
+        misses++;
+        return nullptr;
+    }
+    std::list<entry> &from = it->second->highPri ? sh.high : sh.lru;
+    from.splice(from.begin(), from, it->second); // 移到表头
+    hits++;
+    return it->second->block;
+}
+
+void blockcache::insert(uint64_t file, uint64_t offset, const blockHandle &block, bool highPri) {
+    shard &sh = shardOf(file, offset);
+    std::lock_guard<std::mutex> lock(sh.mtx);
+    if (block->size() > sh.capacity)
+        return; // 放不下，或者缓存被关闭
+    auto it = sh.table.find(blockKey{file, offset});
+    if (it != sh.table.end()) { // 已经有了（并发读同一块），换成新的
+        sh.usage -= it->second->block->size();
+        (it->second->highPri ? sh.high : sh.lru).erase(it->second);
+        sh.table.erase(it);
+    }
+    sh.evict(block->size(), evictions);
+    std::list<entry> &to = highPri ? sh.high : sh.lru;
+    to.push_front(entry{file, offset, block, highPri});
+    sh.table[blockKey{file, offset}] = to.begin();
+    sh.usage += block->size();
+    inserts++;
+}
+
+void blockcache::setCapacity(size_t capacity) {
+    for (shard &sh : shards) {
+        std::lock_guard<std::mutex> lock(sh.mtx);
+        sh.capacity = capacity / shards.size();
+        sh.evict(0, evictions);
+    }
+}
+
+void blockcache::clear() {
+    for (shard &sh : shards) {
+        std::lock_guard<std::mutex> lock(sh.mtx);
+        sh.lru.clear();
+        sh.high.clear();
+        sh.table.clear();
+        sh.usage = 0;
+    }
+}
+
+blockcache::stats blockcache::getStats() {
+    stats res{hits, misses, inserts, evictions, 0, 0};
+    for (shard &sh : shards) {
+        std::lock_guard<std::mutex> lock(sh.mtx);
+        res.usage += sh.usage;
+        res.capacity += sh.capacity;
+    }
+    return res;
+}
+
+void blockcache::resetStats() {
+    hits      = 0;
+    misses    = 0;
+    inserts   = 0;
+    evictions = 0;
+}
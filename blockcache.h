@@ -0,0 +1,83 @@
+#pragma once
+
+#ifndef LSM_KV_BLOCKCACHE_H
+#define LSM_KV_BLOCKCACHE_H
+
+#include <atomic>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+const size_t BLOCK_SIZE           = 4096;             // 数据块大小，读 value 时按块读入缓存
+const size_t BLOCK_CACHE_CAPACITY = 64 * 1024 * 1024; // 默认 64MB
+const int BLOCK_CACHE_SHARD_BITS  = 4;                // 16 个分片，减少锁竞争
+
+typedef std::shared_ptr<const std::string> blockHandle; // 被淘汰后，持有者手里的块仍然有效
+
+/*
+ * sstable 数据块缓存，按 (文件编号, 块偏移) 索引。
+ * 按 key 的哈希分成若干分片，每个分片一把锁、一个 LRU，容量平均分配。
+ * 高优先级的块（索引、过滤器）放在单独的链表里，只有普通块全部淘汰完才会淘汰它们。
+ */
+class blockcache {
+public:
+    struct stats {
+        uint64_t hits, misses, inserts, evictions;
+        size_t usage, capacity;
+    };
+
+private:
+    struct entry {
+        uint64_t file, offset;
+        blockHandle block;
+        bool highPri;
+    };
+
+    struct blockKey {
+        uint64_t file, offset;
+
+        bool operator==(const blockKey &other) const {
+            return file == other.file && offset == other.offset;
+        }
+    };
+
+    struct blockKeyHash {
+        size_t operator()(const blockKey &k) const {
+            uint64_t h = k.file * 0x9e3779b97f4a7c15ull ^ k.offset;
+            return h ^ (h >> 29);
+        }
+    };
+
+    struct shard {
+        std::mutex mtx;
+        std::list<entry> lru, high; // 表头是最近使用的块
+        std::unordered_map<blockKey, std::list<entry>::iterator, blockKeyHash> table;
+        size_t usage    = 0;
+        size_t capacity = 0;
+
+        void evict(size_t need, std::atomic<uint64_t> &evictions); // 腾出 need 字节
+    };
+
+    std::vector<shard> shards;
+    std::atomic<uint64_t> hits, misses, inserts, evictions;
+
+    shard &shardOf(uint64_t file, uint64_t offset);
+
+public:
+    blockcache(size_t capacity = BLOCK_CACHE_CAPACITY, int shardBits = BLOCK_CACHE_SHARD_BITS);
+
+    blockHandle lookup(uint64_t file, uint64_t offset); // 没有命中返回空指针
+    void insert(uint64_t file, uint64_t offset, const blockHandle &block, bool highPri = false);
+
+    void setCapacity(size_t capacity); // 0 表示不缓存
+    void clear();
+
+    stats getStats();
+    void resetStats();
+};
+
+#endif // LSM_KV_BLOCKCACHE_H
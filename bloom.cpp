@@ -1,18 +1,116 @@
 #include "bloom.h"
 
+#include "xorfilter.h"
+
+#include <cstring>
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+// 分块过滤器 8 个位的乘法盐，每个乘积取高 6 位作为块内一个 uint64_t 的位号
+static const uint64_t SALT[8] = {0x47b6137b44974d91, 0x8824ad5ba2b7289d, 0x705495c72df1424b, 0x9efc49475c6bfb31,
+                                 0x44974d91a2b7289d, 0x2df1424b5c6bfb31, 0xa2b7289d47b6137b, 0x5c6bfb31705495c7};
+
+static uint64_t blockOf(uint64_t h, uint64_t blocks) { // 块的第一个 uint64_t 的下标
+    return (h % blocks) * (FILTER_BLOCK / 8);
+}
+
+static void blockMask(uint64_t h, uint64_t mask[8]) {
+    for (int i = 0; i < 8; ++i)
+        mask[i] = 1ull << ((h * SALT[i]) >> 58);
+}
+
+keyHash bloom::hash(uint64_t key) {
+    keyHash res;
+    MurmurHash3_x64_128(&key, sizeof(key), 1, res.h); // MurmurHash3 按 uint64_t 写出，不能直接写进 uint32_t 数组
+    return res;
+}
+
+// 标准 bloom 的 4 个位号：128 位哈希切成 4 段
+static uint32_t bitOf(const keyHash &h, int i, uint64_t bits) {
+    uint32_t hashV[4];
+    std::memcpy(hashV, h.h, sizeof(hashV));
+    return hashV[i] % bits;
+}
+
+uint32_t bloom::sizeFor(filterPolicy policy, uint64_t keys, double bitsPerKey) {
+    if (policy == FILTER_XOR8)
+        return (xorBytes(keys) + FILTER_BLOCK - 1) / FILTER_BLOCK * FILTER_BLOCK;
+    return bytesFor(keys, bitsPerKey);
+}
+
+void bloom::build(const std::vector<uint64_t> &keys, double bitsPerKey) {
+    if (policy == FILTER_XOR8) {
+        std::vector<uint64_t> hashes;
+        hashes.reserve(keys.size());
+        for (uint64_t key : keys)
+            hashes.push_back(hash(key).h[0]);
+        s.assign(sizeFor(policy, keys.size(), bitsPerKey) / FILTER_BLOCK, block{});
+        xorBuild(std::move(hashes), data());
+        return;
+    }
+    s.assign(sizeFor(policy, keys.size(), bitsPerKey) / FILTER_BLOCK, block{});
+    for (uint64_t key : keys)
+        insert(key);
+}
+
 void bloom::insert(uint64_t key) {
-    MurmurHash3_x64_128(&key, sizeof(key), 1, hashV);
+    if (s.empty() || policy == FILTER_XOR8)
+        return;
+    keyHash h = hash(key);
+    if (policy == FILTER_BLOCKED) {
+        uint64_t mask[8];
+        uint64_t *block = words() + blockOf(h.h[0], s.size());
+        blockMask(h.h[1], mask);
+        for (int i = 0; i < 8; ++i)
+            block[i] |= mask[i];
+        return;
+    }
     for (int i = 0; i < 4; ++i) {
-        uint32_t p = (hashV[i] % (8 * M));
-        s[p]       = true;
+        uint32_t p = bitOf(h, i, 8 * size());
+        words()[p / 64] |= 1ull << (p % 64);
     }
 }
 
-bool bloom::search(uint64_t key) {
-    MurmurHash3_x64_128(&key, sizeof(key), 1, hashV);
+void bloom::prefetch(const keyHash &h) const {
+    if (s.empty())
+        return;
+    if (policy == FILTER_XOR8) {
+        xorPrefetch(data(), h.h[0]);
+        return;
+    }
+    if (policy == FILTER_BLOCKED) {
+        __builtin_prefetch(words() + blockOf(h.h[0], s.size()));
+        return;
+    }
+    for (int i = 0; i < 4; ++i)
+        __builtin_prefetch(words() + bitOf(h, i, 8 * size()) / 64);
+}
+
+bool bloom::mayContain(const keyHash &h) const {
+    if (s.empty())
+        return true;
+    if (policy == FILTER_XOR8)
+        return xorContain(data(), h.h[0]);
+    if (policy == FILTER_BLOCKED) { // 只碰一条 cache line，整块一次比较
+        alignas(32) uint64_t mask[8];
+        const uint64_t *block = words() + blockOf(h.h[0], s.size());
+        blockMask(h.h[1], mask);
+#if defined(__AVX2__)
+        __m256i lo = _mm256_load_si256(reinterpret_cast<const __m256i *>(block));
+        __m256i hi = _mm256_load_si256(reinterpret_cast<const __m256i *>(block + 4));
+        return _mm256_testc_si256(lo, _mm256_load_si256(reinterpret_cast<const __m256i *>(mask))) &&
+               _mm256_testc_si256(hi, _mm256_load_si256(reinterpret_cast<const __m256i *>(mask + 4)));
+#else
+        uint64_t miss = 0; // 没有分支，编译器可以向量化
+        for (int i = 0; i < 8; ++i)
+            miss |= mask[i] & ~block[i];
+        return !miss;
+#endif
+    }
     for (int i = 0; i < 4; ++i) {
-        uint32_t p = (hashV[i] % (8 * M));
-        if (!s[p])
+        uint32_t p = bitOf(h, i, 8 * size());
+        if (!((words()[p / 64] >> (p % 64)) & 1))
             return false;
     }
     return true;
@@ -2,45 +2,85 @@
 #define LSM_KV_BLOOM_H
 #include "MurmurHash3.h"
 
-#include <bitset>
 #include <cstdint>
+#include <vector>
 
-const uint32_t M = 10240;
+const uint32_t M            = 10240; // v1 ~ v3 格式固定的过滤器字节数
+const uint32_t FILTER_BLOCK = 64;    // 过滤器按 64 字节一块分配，分块过滤器每块一条 cache line
+const double BITS_PER_KEY   = 10;    // 默认每个 key 分到的过滤器位数
+
+enum filterPolicy : uint32_t {
+    FILTER_BLOOM   = 0, // 4 个独立的位，v1 ~ v3 格式只支持这一种
+    FILTER_BLOCKED = 1, // 一个 key 的 8 个位落在同一个 64 字节的块里，每个 uint64_t 一位
+    FILTER_XOR8    = 2, // 静态的 Xor8 过滤器，不管位数设置，每个 key 约 9.84 位，只能用 build 一次建好
+};
+
+struct keyHash { // 一个 key 的 MurmurHash3，查多个过滤器时只算一次
+    uint64_t h[2];
+};
 
 class bloom {
 private:
-    std::bitset<8 * M> s;
-    uint32_t hashV[4];
+    struct alignas(FILTER_BLOCK) block {
+        uint64_t w[FILTER_BLOCK / 8];
+    };
+
+    std::vector<block> s; // 第 p 位在第 p / 64 个 uint64_t 的第 p % 64 位，小端下与老格式逐字节一致
+    filterPolicy policy;
+
+    uint64_t *words() {
+        return s.data()->w;
+    }
+
+    const uint64_t *words() const {
+        return s.data()->w;
+    }
 
 public:
-    bloom() {}
+    explicit bloom(filterPolicy policy = FILTER_BLOOM, uint32_t bytes = 0) : s(bytes / FILTER_BLOCK), policy(policy) {}
+
+    static uint32_t bytesFor(uint64_t keys, double bitsPerKey) { // 按每个 key 的位数取整到块，至少一块
+        uint64_t blocks = (uint64_t)(keys * bitsPerKey + 8 * FILTER_BLOCK - 1) / (8 * FILTER_BLOCK);
+        return (blocks ? blocks : 1) * FILTER_BLOCK;
+    }
+
+    static uint32_t sizeFor(filterPolicy policy, uint64_t keys, double bitsPerKey); // build 之后过滤器的字节数
 
-    ~bloom() {
-        s.reset();
+    void reset() { // 清空，保留策略和大小
+        s.assign(s.size(), block{});
     }
 
-    void reset() {
-        s.reset();
+    void reset(filterPolicy policy, uint32_t bytes) { // 换策略和大小，bytes 要是 FILTER_BLOCK 的倍数
+        this->policy = policy;
+        s.assign(bytes / FILTER_BLOCK, block{});
     }
 
-    void setBitset(std::bitset<8 * M> t) {
-        s = t;
+    filterPolicy getPolicy() const {
+        return policy;
     }
 
-    std::bitset<8 * M> getBitset() {
-        return s;
+    char *data() { // 整块读写，用 memcpy 序列化
+        return reinterpret_cast<char *>(s.data());
     }
 
-    bool getBit(uint32_t p) {
-        return s[p];
+    const char *data() const {
+        return reinterpret_cast<const char *>(s.data());
     }
 
-    void setBit(uint32_t p) {
-        s[p] = true;
+    uint32_t size() const {
+        return s.size() * FILTER_BLOCK;
     }
 
-    void insert(uint64_t key);
-    bool search(uint64_t key);
+    static keyHash hash(uint64_t key);
+
+    void build(const std::vector<uint64_t> &keys, double bitsPerKey); // 按当前策略重新分配大小并放入所有 key
+    void insert(uint64_t key);                                        // 只用于 bloom 和分块过滤器
+    bool mayContain(const keyHash &h) const; // 没有分配过滤器时总是返回 true
+    void prefetch(const keyHash &h) const;   // 预取 mayContain(h) 要读的 cache line
+
+    bool search(uint64_t key) const {
+        return mayContain(hash(key));
+    }
 };
 
 #endif // LSM_KV_BLOOM_H
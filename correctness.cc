@@ -1,14 +1,39 @@
 #include "test.h"
 
+#include <algorithm>
+#include <atomic>
 #include <cstdint>
+#include <filesystem>
+#include <fstream>
 #include <iostream>
+#include <mutex>
+#include <random>
 #include <string>
+#include <thread>
+#include <vector>
 
 class CorrectnessTest : public Test {
 private:
     const uint64_t SIMPLE_TEST_MAX = 512;
     const uint64_t LARGE_TEST_MAX  = 1024 * 64;
 
+    // [from, to) 内的 key 每 100 个倒序调用一次 multi_get，另带一个重复的 key
+    template <typename F>
+    void expect_multi_get(uint64_t from, uint64_t to, F expected) {
+        for (uint64_t start = from; start < to; start += 100) {
+            std::vector<uint64_t> keys;
+            for (uint64_t k = std::min(start + 100, to); k-- > start;)
+                keys.push_back(k);
+            keys.push_back(start);
+            std::vector<std::string> vals = store.multi_get(keys);
+            EXPECT(keys.size(), vals.size());
+            for (size_t k = 0; k < keys.size() && k < vals.size(); ++k) {
+                std::string val = vals[k];
+                EXPECT(expected(keys[k]), val);
+            }
+        }
+    }
+
     void insert_test(uint64_t max) {
         uint64_t i;
         for (i = 0; i < max; ++i) {
@@ -135,6 +160,717 @@ private:
         report();
     }
 
+    void multi_get_test(uint64_t max) {
+        uint64_t i;
+
+        for (i = 0; i < max; ++i)
+            store.put(i, std::string(i + 1, 's'));
+
+        // Test multi_get, including missing keys
+        expect_multi_get(0, max + max / 4, [&](uint64_t k) { return k < max ? std::string(k + 1, 's') : not_found; });
+        phase();
+
+        // Test multi_get after deletions
+        for (i = 0; i < max; i += 2)
+            store.del(i);
+
+        expect_multi_get(0, max, [&](uint64_t k) { return (k & 1) ? std::string(k + 1, 's') : not_found; });
+        phase();
+
+        report();
+    }
+
+    void batch_test(uint64_t max) {
+        uint64_t i;
+        WriteBatch batch;
+
+        // Test a batch of insertions
+        for (i = 0; i < max; ++i)
+            batch.put(i, std::string(i + 1, 'b'));
+        store.write(batch);
+
+        for (i = 0; i < max; ++i)
+            EXPECT(std::string(i + 1, 'b'), store.get(i));
+        phase();
+
+        // Test a batch mixing deletions and updates
+        batch.clear();
+        for (i = 0; i < max; i += 2)
+            batch.del(i);
+        for (i = 1; i < max; i += 4)
+            batch.put(i, std::string(i + 1, 'c'));
+        store.write(batch);
+
+        for (i = 0; i < max; ++i) {
+            switch (i & 3) {
+            case 1:
+                EXPECT(std::string(i + 1, 'c'), store.get(i));
+                break;
+            case 3:
+                EXPECT(std::string(i + 1, 'b'), store.get(i));
+                break;
+            default:
+                EXPECT(not_found, store.get(i));
+            }
+        }
+        phase();
+
+        // Test blind deletions, including keys that never existed
+        for (i = 0; i < max * 2; i += 3)
+            store.del_blind(i);
+
+        for (i = 0; i < max; ++i) {
+            if (i % 3 == 0)
+                EXPECT(not_found, store.get(i));
+            else if ((i & 3) == 1)
+                EXPECT(std::string(i + 1, 'c'), store.get(i));
+            else if ((i & 3) == 3)
+                EXPECT(std::string(i + 1, 'b'), store.get(i));
+            else
+                EXPECT(not_found, store.get(i));
+        }
+        phase();
+
+        // Test that a batch larger than one sstable is rejected as a whole
+        batch.clear();
+        for (i = 0; i < 3; ++i)
+            batch.put(max * 2 + i, std::string(1024 * 1024, 'd'));
+        EXPECT(false, store.write(batch));
+        for (i = 0; i < 3; ++i)
+            EXPECT(not_found, store.get(max * 2 + i));
+        phase();
+
+        report();
+    }
+
+    void recovery_test(uint64_t max) {
+        uint64_t i;
+        namespace fs = std::filesystem;
+        // 在析构(会 flush memtable)之前拷贝 data/，相当于进程在这一刻退出
+        auto crashImage = [] {
+            fs::remove_all("./data_crash");
+            fs::copy("./data", "./data_crash", fs::copy_options::recursive);
+        };
+        // 清空 store 后把拷贝写回 data/，wal.log 原地覆盖，store 持有的 fd 仍然有效
+        auto restore = [this] {
+            store.reset();
+            fs::copy("./data_crash", "./data", fs::copy_options::recursive | fs::copy_options::overwrite_existing);
+        };
+
+        // Test that acknowledged writes still in the memtable are replayed from the log
+        for (i = 0; i < max; ++i)
+            store.put(i, std::string(i + 1, 'r'));
+        for (i = 0; i < max; i += 3)
+            store.del(i);
+        crashImage();
+        restore();
+        {
+            KVStore crashed("./data");
+            for (i = 0; i < max; ++i)
+                EXPECT(i % 3 ? std::string(i + 1, 'r') : not_found, crashed.get(i));
+            crashed.reset(); // store 不知道 crashed 写出的表，由它自己删掉
+        }
+        phase();
+
+        // Test that replay drops a torn record at the tail of the log and keeps the rest
+        store.reset();
+        for (i = 0; i < max; ++i)
+            store.put(i, std::string(i + 1, 't'));
+        crashImage();
+        uint64_t logSize = fs::file_size("./data_crash/wal.log");
+        {
+            wal::record rec;
+            rec.add(wal::OP_PUT, max, std::string(max, 't'));
+            const std::string &rep = rec.seal();
+            std::ofstream("./data_crash/wal.log", std::ios::binary | std::ios::app) << rep.substr(0, rep.size() / 2);
+        }
+        restore();
+        {
+            KVStore crashed("./data");
+            EXPECT(logSize, (uint64_t)fs::file_size("./data/wal.log")); // 残缺的尾部被截掉
+            for (i = 0; i < max; ++i)
+                EXPECT(std::string(i + 1, 't'), crashed.get(i));
+            EXPECT(not_found, crashed.get(max));
+            crashed.reset();
+        }
+        phase();
+
+        fs::remove_all("./data_crash");
+        report();
+    }
+
+    void range_delete_test(uint64_t max) {
+        uint64_t i;
+
+        for (i = 0; i < max; ++i)
+            store.put(i, std::string(i + 1, 's'));
+
+        // Test a range tombstone over data in memtable and sstables
+        store.del_range(max / 4, max / 2 - 1);
+
+        for (i = 0; i < max; ++i)
+            EXPECT((i >= max / 4 && i < max / 2) ? not_found : std::string(i + 1, 's'), store.get(i));
+        phase();
+
+        // Test scan across the deleted range
+        std::list<std::pair<uint64_t, std::string>> list_stu;
+        store.scan(0, max - 1, list_stu);
+        EXPECT(max - max / 4, (uint64_t)list_stu.size());
+
+        uint64_t key = 0;
+        for (auto &p : list_stu) {
+            if (key == max / 4)
+                key = max / 2;
+            EXPECT(key, p.first);
+            EXPECT(std::string(key + 1, 's'), p.second);
+            key++;
+        }
+        phase();
+
+        // Test writes after the range tombstone
+        for (i = max / 4; i < max / 2; i += 2)
+            store.put(i, std::string(i + 1, 't'));
+
+        for (i = max / 4; i < max / 2; ++i)
+            EXPECT((i & 1) ? not_found : std::string(i + 1, 't'), store.get(i));
+        phase();
+
+        // Test multi_get across the deleted range
+        expect_multi_get(0, max, [&](uint64_t k) {
+            if (k < max / 4 || k >= max / 2)
+                return std::string(k + 1, 's');
+            return (k & 1) ? not_found : std::string(k + 1, 't');
+        });
+        phase();
+
+        // Test a scan ending at INF over a table that holds only a range tombstone
+        store.reset();
+        store.del_range(100, INF);
+        { KVStore flushed("./data"); } // 重放日志，关闭时把范围删除写成一张 sstable
+        {
+            KVStore reopened("./data");
+            list_stu.clear();
+            reopened.scan(INF - 2, INF, list_stu);
+            EXPECT((uint64_t)0, (uint64_t)list_stu.size());
+            EXPECT(not_found, reopened.get(INF));
+            reopened.reset(); // store 不知道这张表，由打开它的实例删掉
+        }
+        phase();
+
+        report();
+    }
+
+    void merge_test(uint64_t max) {
+        uint64_t i;
+
+        for (i = 0; i < max; i += 2)
+            store.put(i, std::string(i + 1, 's'));
+
+        // Test merge onto values in memtable and sstables, and onto missing keys
+        for (i = 0; i < max; ++i)
+            store.merge(i, "m");
+
+        for (i = 0; i < max; ++i)
+            EXPECT((i & 1) ? std::string("m") : std::string(i + 1, 's') + "m", store.get(i));
+        phase();
+
+        // Test scan over merged keys
+        std::list<std::pair<uint64_t, std::string>> list_stu;
+        store.scan(0, max - 1, list_stu);
+        EXPECT(max, (uint64_t)list_stu.size());
+
+        i = 0;
+        for (auto &p : list_stu) {
+            EXPECT(i, p.first);
+            EXPECT((i & 1) ? std::string("m") : std::string(i + 1, 's') + "m", p.second);
+            i++;
+        }
+        phase();
+
+        // Test merge after delete starts from an empty value
+        for (i = 0; i < max; i += 3)
+            store.del(i);
+        for (i = 0; i < max; i += 3)
+            store.merge(i, "n");
+
+        for (i = 0; i < max; ++i) {
+            std::string key = (i & 1) ? std::string("m") : std::string(i + 1, 's') + "m";
+            EXPECT(i % 3 ? key : std::string("n"), store.get(i));
+        }
+        phase();
+
+        // Test multi_get folds merge operands the same way
+        expect_multi_get(0, max, [&](uint64_t k) {
+            if (k % 3 == 0)
+                return std::string("n");
+            return (k & 1) ? std::string("m") : std::string(k + 1, 's') + "m";
+        });
+        phase();
+
+        // Test a counter operator across several flushes
+        store.reset();
+        auto counter = [](uint64_t, const std::string *existing, const std::string &operand) {
+            return std::to_string((existing ? std::stoull(*existing) : 0) + std::stoull(operand));
+        };
+        store.setMergeOperator(counter);
+        for (uint64_t round = 1; round <= 4; ++round) {
+            for (i = 0; i < max; ++i)
+                store.merge(i, std::to_string(round));
+            for (i = 0; i < max; i += 16)
+                store.put(max + i, std::string(1024 * 8, 'p')); // 推动落盘和合并
+        }
+
+        for (i = 0; i < max; ++i)
+            EXPECT(std::string("10"), store.get(i));
+        phase();
+
+        // Test a crash after the level-0 table is written but before the log is truncated
+        store.reset();
+        for (i = 0; i < max; ++i)
+            store.merge(i, "1");
+        std::string log;
+        {
+            std::ifstream in("./data/wal.log", std::ios::binary);
+            log.assign(std::istreambuf_iterator<char>(in), {});
+        }
+        for (i = 0; std::filesystem::file_size("./data/wal.log") >= log.size(); ++i)
+            store.put(max + i, std::string(1024 * 8, 'p')); // 直到 flush 清空了日志
+        std::ofstream("./data/wal.log", std::ios::binary | std::ios::trunc) << log; // 日志回到 flush 之前
+        {
+            KVStore crashed("./data", counter);
+            for (i = 0; i < max; ++i)
+                EXPECT(std::string("1"), crashed.get(i));
+        }
+        phase();
+
+        store.setMergeOperator(appendOperator);
+        report();
+    }
+
+    void filter_test(uint64_t max) {
+        uint64_t i;
+
+        // Test tables written with every filter policy side by side
+        for (i = 0; i < max; ++i) {
+            if (i == max / 3)
+                store.setFilterPolicy(FILTER_BLOCKED);
+            if (i == max / 3 * 2)
+                store.setFilterPolicy(FILTER_XOR8);
+            store.put(i, std::string(256, 'a' + i % 26));
+        }
+
+        for (i = 0; i < max; ++i)
+            EXPECT(std::string(256, 'a' + i % 26), store.get(i));
+        phase();
+
+        // Test missing keys are still filtered out
+        for (i = max; i < max * 2; ++i)
+            EXPECT(not_found, store.get(i));
+        phase();
+
+        // Test tables with a tiny filter budget
+        store.setFilterBitsPerKey(1, false);
+        for (i = max; i < max * 2; i += 2)
+            store.put(i, std::string(256, 'z'));
+
+        for (i = 0; i < max * 2; ++i) {
+            std::string val = i < max ? std::string(256, 'a' + i % 26) : std::string(256, 'z');
+            EXPECT((i >= max && (i & 1)) ? not_found : val, store.get(i));
+        }
+        phase();
+
+        // Test short scans over a sparse key space
+        uint64_t base = max * 4;
+        for (i = 0; i < max / 16; ++i)
+            store.put(base + i * 4096, std::string(256, 'r'));
+
+        for (i = 0; i < max / 16; ++i) {
+            std::list<std::pair<uint64_t, std::string>> list_stu;
+            store.scan(base + i * 4096 - 100, base + i * 4096 + 100, list_stu);
+            EXPECT((uint64_t)1, (uint64_t)list_stu.size());
+            list_stu.clear();
+            store.scan(base + i * 4096 + 1, base + i * 4096 + 4095, list_stu);
+            EXPECT((uint64_t)0, (uint64_t)list_stu.size());
+        }
+        phase();
+
+        store.setFilterBitsPerKey(BITS_PER_KEY);
+        store.setFilterPolicy(FILTER_BLOOM);
+        report();
+    }
+
+    void row_cache_test(uint64_t max) {
+        uint64_t i;
+
+        store.setRowCacheCapacity(1024 * 1024 * 8);
+        for (i = 0; i < max; ++i)
+            store.put(i, std::string(i % 64 + 1, 'c'));
+
+        // Test cached values, including cached misses
+        for (int round = 0; round < 2; ++round) {
+            for (i = 0; i < max * 2; ++i)
+                EXPECT(i < max ? std::string(i % 64 + 1, 'c') : not_found, store.get(i));
+        }
+        phase();
+
+        // Test put, del and merge invalidate cached keys
+        for (i = 0; i < max; i += 4) {
+            store.put(i, "p");
+            store.del(i + 1);
+            store.merge(i + 2, "m");
+            store.put(max + i, "n");
+        }
+        WriteBatch batch;
+        for (i = 3; i < max; i += 4)
+            batch.put(i, "b");
+        store.write(batch);
+
+        auto expected = [&](uint64_t k) {
+            if (k >= max)
+                return k % 4 ? not_found : std::string("n");
+            switch (k % 4) {
+            case 0:
+                return std::string("p");
+            case 1:
+                return not_found;
+            case 2:
+                return std::string(k % 64 + 1, 'c') + "m";
+            default:
+                return std::string("b");
+            }
+        };
+        for (i = 0; i < max * 2; ++i)
+            EXPECT(expected(i), store.get(i));
+        phase();
+
+        // Test range deletes drop cached values
+        store.del_range(max / 4, max / 2 - 1);
+        for (i = 0; i < max * 2; ++i)
+            EXPECT(i >= max / 4 && i < max / 2 ? not_found : expected(i), store.get(i));
+        phase();
+
+        // Test the cache stays within its capacity
+        rowcache::stats st = store.getRowCacheStats();
+        EXPECT(true, st.hits > 0 && st.usage <= st.capacity);
+        phase();
+
+        store.setRowCacheCapacity(0);
+        report();
+    }
+
+    void iterator_test(uint64_t max) {
+        uint64_t i;
+
+        for (i = 0; i < max; ++i)
+            store.put(i * 2, std::string(i % 64 + 1, 'i'));
+        store.del_range(max / 2, max - 1);
+        for (i = 0; i < max / 4; ++i)
+            store.merge(i * 2, "m");
+        auto expected = [&](uint64_t k) {
+            if (k & 1 || k >= max * 2 || (k >= max / 2 && k < max))
+                return not_found;
+            return std::string(k / 2 % 64 + 1, 'i') + (k < max / 2 ? "m" : "");
+        };
+
+        // Test forward and backward iteration over memtable and sstables
+        std::unique_ptr<Iterator> it = store.new_iterator();
+        uint64_t count = 0, last = 0;
+        for (it->seekToFirst(); it->valid(); it->next(), ++count) {
+            EXPECT(true, count == 0 || it->key() > last);
+            EXPECT(expected(it->key()), std::string(it->value()));
+            last = it->key();
+        }
+        EXPECT(max - max / 4, count);
+        for (it->seekToLast(); it->valid(); it->prev(), --count) {
+            EXPECT(expected(it->key()), std::string(it->value()));
+            last = it->key();
+        }
+        EXPECT((uint64_t)0, count);
+        EXPECT((uint64_t)0, last);
+        phase();
+
+        // Test seek, prev from a seek and the bounds of a bounded iterator
+        it->seek(max / 2 - 1);
+        EXPECT(max, it->key());
+        it->prev();
+        EXPECT(max / 2 - 2, it->key());
+        it->next();
+        EXPECT(max, it->key());
+        it = store.new_iterator(max + 1, max + 9);
+        it->seekToFirst();
+        EXPECT(max + 2, it->key());
+        it->prev();
+        EXPECT(false, it->valid());
+        it->seekToLast();
+        EXPECT(max + 8, it->key());
+        it->next();
+        EXPECT(false, it->valid());
+        phase();
+
+        // Test writes between steps, including a flush of the memtable
+        it = store.new_iterator();
+        it->seek(max * 2 - 10);
+        store.del(max * 2 - 8);
+        store.put(max * 2 - 7, "odd");
+        for (i = 0; i < max; ++i)
+            store.put(max * 2 + i, std::string(256, 'f'));
+        it->next();
+        EXPECT(max * 2 - 7, it->key());
+        EXPECT(std::string("odd"), std::string(it->value()));
+        it->next();
+        EXPECT(max * 2 - 6, it->key());
+        it->prev();
+        it->prev();
+        EXPECT(max * 2 - 10, it->key());
+        phase();
+
+        // Test scan with a row limit
+        std::list<std::pair<uint64_t, std::string>> list;
+        store.scan(0, max * 2, list, 10);
+        EXPECT((uint64_t)10, (uint64_t)list.size());
+        EXPECT((uint64_t)18, list.back().first);
+        phase();
+
+        // Test parallel scan, in key order and unordered
+        list.clear();
+        store.scan(0, INF, list);
+        std::vector<std::pair<uint64_t, std::string>> all(list.begin(), list.end()), rows;
+        store.parallel_scan(0, INF, [&](uint64_t k, std::string_view v) { rows.emplace_back(k, v); }, 4);
+        EXPECT(true, rows == all);
+        std::mutex mtx;
+        rows.clear();
+        store.parallel_scan(
+            max / 3, max * 3,
+            [&](uint64_t k, std::string_view v) {
+                std::lock_guard<std::mutex> lock(mtx);
+                rows.emplace_back(k, v);
+            },
+            4, false);
+        std::sort(rows.begin(), rows.end());
+        all.erase(std::remove_if(all.begin(), all.end(), [&](auto &p) { return p.first < max / 3 || p.first > max * 3; }),
+                  all.end());
+        EXPECT(true, rows == all);
+        phase();
+
+        report();
+    }
+
+    void snapshot_test(uint64_t max) {
+        uint64_t i;
+
+        store.setBlockCacheCapacity(0); // 快照的读都要落到文件上
+        for (i = 0; i < max; ++i)
+            store.put(i, std::string(i % 64 + 256, 's')); // 一部分已经落到 sstable
+        auto expected = [&](uint64_t k) {
+            return k < max ? std::string(k % 64 + 256, 's') : not_found;
+        };
+
+        // Test that later writes are hidden from the snapshot
+        const Snapshot *snap = store.get_snapshot();
+        store.put(0, "new");
+        store.del(1);
+        store.del_range(2, 9);
+        store.merge(10, "m");
+        store.put(max, "new");
+        for (i = 0; i <= max; ++i)
+            EXPECT(expected(i), store.get(i, snap));
+        EXPECT(std::string("new"), store.get(0));
+        EXPECT(not_found, store.get(1));
+        EXPECT(expected(10) + "m", store.get(10));
+        phase();
+
+        // Test that flushes and compactions keep the snapshot's tables readable
+        for (i = 0; i < max * 4; ++i)
+            store.put(i % max, std::string(512, 'o'));
+        for (i = 0; i <= max; ++i)
+            EXPECT(expected(i), store.get(i, snap));
+        EXPECT(std::string(512, 'o'), store.get(max / 2));
+        phase();
+
+        // Test iterating a snapshot with writes between steps
+        std::unique_ptr<Iterator> it = store.new_iterator(0, INF, snap);
+        uint64_t count = 0;
+        for (it->seekToFirst(); it->valid(); it->next(), ++count) {
+            EXPECT(count, it->key());
+            EXPECT(expected(count), std::string(it->value()));
+            if (count == max / 2)
+                store.del_range(0, max * 2);
+        }
+        EXPECT(max, count);
+        for (it->seekToLast(); it->valid(); it->prev())
+            --count;
+        EXPECT((uint64_t)0, count);
+        it.reset();
+        std::list<std::pair<uint64_t, std::string>> list;
+        store.scan(0, INF, list, SIZE_MAX, snap);
+        EXPECT(max, (uint64_t)list.size());
+        list.clear();
+        store.scan(0, INF, list);
+        EXPECT((uint64_t)0, (uint64_t)list.size());
+        phase();
+
+        // Test sequence numbers and release
+        const Snapshot *same = store.get_snapshot();
+        const Snapshot *again = store.get_snapshot();
+        EXPECT(true, same->getSequence() > snap->getSequence());
+        EXPECT(same->getSequence(), again->getSequence());
+        store.release_snapshot(snap);
+        store.release_snapshot(again);
+        store.put(1, "after");
+        EXPECT(not_found, store.get(1, same));
+        EXPECT(std::string("after"), store.get(1));
+        store.release_snapshot(same);
+        phase();
+
+        store.setBlockCacheCapacity(BLOCK_CACHE_CAPACITY);
+        report();
+    }
+
+    void concurrent_read_test(uint64_t max) {
+        const int rounds = 4;
+        uint64_t i;
+
+        // 第 r 轮写入的值：长度由 key 决定，每个字符都是 'a' + r；返回值的轮次，值不完整时返回 -1
+        auto value = [](uint64_t k, int r) { return std::string(k % 64 + 256, 'a' + r); };
+        auto round = [](uint64_t k, const std::string &v) {
+            if (v.size() != k % 64 + 256 || v.find_first_not_of(v[0]) != std::string::npos)
+                return -1;
+            return v[0] - 'a';
+        };
+        for (i = 0; i < max; ++i)
+            store.put(i, value(i, 0));
+
+        // 读线程不加锁，断言只在主线程里做
+        std::atomic<int> written(0); // 已经整轮写完的轮次
+        std::atomic<bool> stop(false);
+        std::atomic<uint64_t> bad(0);
+        auto readers = [&](auto body) {
+            std::vector<std::thread> threads;
+            for (int t = 0; t < 2; ++t)
+                threads.emplace_back([&, body, t] {
+                    std::mt19937_64 rng(t);
+                    while (!stop)
+                        body(rng);
+                });
+            return threads;
+        };
+
+        // Test gets while the writer overwrites every key, flushing and compacting
+        std::vector<std::thread> threads = readers([&](std::mt19937_64 &rng) {
+            uint64_t k = rng() % max;
+            int lo     = written;
+            int r      = round(k, store.get(k));
+            if (r < lo || r > rounds)
+                ++bad;
+        });
+        for (int r = 1; r <= rounds; ++r) {
+            for (i = 0; i < max; ++i)
+                store.put(i, value(i, r));
+            written = r;
+        }
+        stop = true;
+        for (std::thread &t : threads)
+            t.join();
+        EXPECT((uint64_t)0, bad.load());
+        phase();
+
+        // Test iterators and multi_get while the writer deletes and refills keys next to the range
+        stop = false;
+        threads = readers([&](std::mt19937_64 &rng) {
+            uint64_t lower = rng() % max, count = 0;
+            std::unique_ptr<Iterator> it = store.new_iterator(lower, max - 1);
+            for (it->seekToFirst(); it->valid(); it->next(), ++count) {
+                if (it->key() != lower + count || round(it->key(), std::string(it->value())) != rounds)
+                    ++bad;
+            }
+            if (count != max - lower)
+                ++bad;
+            std::vector<uint64_t> keys{lower, max - 1, max + lower};
+            std::vector<std::string> vals = store.multi_get(keys);
+            if (round(keys[0], vals[0]) != rounds || round(keys[1], vals[1]) != rounds)
+                ++bad;
+            if (!vals[2].empty() && round(keys[2], vals[2]) < 0)
+                ++bad;
+        });
+        for (int r = 0; r < rounds; ++r) {
+            for (i = max; i < max * 2; ++i)
+                store.put(i, value(i, r));
+            store.del_range(max, max * 2);
+        }
+        stop = true;
+        for (std::thread &t : threads)
+            t.join();
+        EXPECT((uint64_t)0, bad.load());
+        phase();
+
+        // Test that multi_get sees each write batch and range delete entirely or not at all
+        const uint64_t width = 16, base = max * 2; // 一批的 key 分散在 [base, base + width * 64)
+        auto batches = [&] { // 每批写 width * 2 个 key，每十批有一次范围删除，最后全部删掉
+            for (int r = 0; r < 2000; ++r) {
+                if (r % 10 == 9) {
+                    store.del_range(base, base + width * 64);
+                    continue;
+                }
+                WriteBatch batch;
+                for (uint64_t j = 0; j < width * 2; ++j) {
+                    uint64_t k = base + j / 2 * 64 + j % 2;
+                    batch.put(k, value(k, r % 26));
+                }
+                store.write(batch);
+            }
+            store.del_range(base, base + width * 64);
+        };
+        stop    = false;
+        threads = readers([&](std::mt19937_64 &rng) {
+            std::vector<uint64_t> keys;
+            for (uint64_t j = 0; j < width; ++j)
+                keys.push_back(base + j * 64 + rng() % 2);
+            std::vector<std::string> vals = store.multi_get(keys);
+            auto seen = [&](uint64_t j) { return vals[j].empty() ? -2 : round(keys[j], vals[j]); }; // -2: 删掉了
+            for (uint64_t j = 0; j < width; ++j) {
+                if (seen(j) == -1 || seen(j) != seen(0))
+                    ++bad;
+            }
+        });
+        batches();
+        stop = true;
+        for (std::thread &t : threads)
+            t.join();
+        EXPECT((uint64_t)0, bad.load());
+        phase();
+
+        // Test that one parallel_scan reads a single point in time
+        stop    = false;
+        threads = readers([&](std::mt19937_64 &) {
+            std::vector<std::pair<uint64_t, std::string>> rows;
+            store.parallel_scan(base, base + width * 64,
+                                [&](uint64_t k, std::string_view v) { rows.emplace_back(k, v); }, 4);
+            if (!rows.empty() && rows.size() != width * 2)
+                ++bad;
+            for (const auto &row : rows) {
+                int r = round(row.first, row.second);
+                if (r < 0 || r != round(rows[0].first, rows[0].second))
+                    ++bad;
+            }
+        });
+        batches();
+        stop = true;
+        for (std::thread &t : threads)
+            t.join();
+        EXPECT((uint64_t)0, bad.load());
+        phase();
+
+        // Test the final state once the readers are gone
+        for (i = 0; i < max * 2; ++i)
+            EXPECT(i < max ? value(i, rounds) : not_found, store.get(i));
+        std::list<std::pair<uint64_t, std::string>> list;
+        store.scan(0, INF, list);
+        EXPECT(max, (uint64_t)list.size());
+        phase();
+
+        report();
+    }
+
 public:
     CorrectnessTest(const std::string &dir, bool v = true) : Test(dir, v) {}
 
@@ -151,6 +887,56 @@ public:
         std::cout << "[Large Test]" << std::endl;
         regular_test(1024 * 64);
 
+        store.reset();
+
+        std::cout << "[Multi Get Test]" << std::endl;
+        multi_get_test(1024 * 64);
+
+        store.reset();
+
+        std::cout << "[Batch & Blind Delete Test]" << std::endl;
+        batch_test(SIMPLE_TEST_MAX);
+
+        store.reset();
+
+        std::cout << "[WAL Recovery Test]" << std::endl;
+        recovery_test(SIMPLE_TEST_MAX);
+
+        store.reset();
+
+        std::cout << "[Range Delete Test]" << std::endl;
+        range_delete_test(1024 * 16);
+
+        store.reset();
+
+        std::cout << "[Merge Test]" << std::endl;
+        merge_test(1024 * 4);
+
+        store.reset();
+
+        std::cout << "[Filter Policy Test]" << std::endl;
+        filter_test(1024 * 64);
+
+        store.reset();
+
+        std::cout << "[Row Cache Test]" << std::endl;
+        row_cache_test(1024 * 16);
+
+        store.reset();
+
+        std::cout << "[Iterator Test]" << std::endl;
+        iterator_test(1024 * 16);
+
+        store.reset();
+
+        std::cout << "[Snapshot Test]" << std::endl;
+        snapshot_test(1024 * 16);
+
+        store.reset();
+
+        std::cout << "[Concurrent Read Test]" << std::endl;
+        concurrent_read_test(1024 * 16);
+
         //        store.reset();
         //        std::cout << "[Insert Test]" << std::endl;
         //        insert_test(1024 * 16);
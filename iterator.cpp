@@ -0,0 +1,242 @@
+#include "iterator.h"
+
+#include "kvstore.h"
+
+#include <algorithm>
+
+// 停在最后一个 <= key 的记录
+template <class T> static void seekForPrev(T &it, uint64_t key) {
+    it.seek(key);
+    if (!it.valid())
+        it.seekToLast();
+    else if (it.key() > key)
+        it.prev();
+}
+
+Iterator::Iterator(KVStore *store, uint64_t lower, uint64_t upper, const Snapshot *snap)
+    : store(store), snap(snap), lower(lower), upper(upper), mem(nullptr) {} // 第一次定位时建立 mem 和 tables
+
+bool Iterator::refresh() {
+    std::shared_ptr<const tableset> now = store->viewOf(snap);
+    if (now == view) // 手里的版本还没有释放，不会有别的版本用同一个地址
+        return false;
+    view = std::move(now);
+    mem  = memiter(view->mem.get());
+    tables.clear();
+    ranges.clear();
+    auto add = [&](const tableHandle &t, int level) {
+        if (lower > t->getMaxV() || upper < t->getMinV())
+            return; // 无交集
+        for (const rangeDel &r : t->getRanges()) {
+            if (r.start <= upper && r.end >= lower)
+                ranges.emplace_back(r, t->getTime(), level);
+        }
+        if (store->rangeFilterOn && !t->mayOverlap(lower, upper))
+            return; // 区间里没有点，不用读块
+        tables.push_back(source{tableiter(store, t), t->getTime(), level});
+    };
+    if (view->top() >= 0) {
+        const std::vector<tableHandle> &all = view->levels[0];
+        for (size_t i = all.size(); i-- > 0;) // 0 层从新到旧
+            add(all[i], 0);
+    }
+    for (int level = 1; level <= view->top(); ++level) {
+        const std::vector<tableHandle> &all = view->levels[level];
+        for (size_t i = KVStore::findTable(all, lower); i < all.size() && all[i]->getMinV() <= upper; ++i)
+            add(all[i], level); // 非 0 层按 key 有序，只看覆盖 [lower, upper] 的一段
+    }
+    return true;
+}
+
+void Iterator::position(uint64_t key, bool fwd) {
+    forward = fwd;
+    if (fwd)
+        mem.seek(key);
+    else
+        seekForPrev(mem, key);
+    // 每张表 key 所在的块一起异步读进来
+    asyncreader &io = asyncreader::local();
+    std::vector<blockHandle> first(tables.size()); // 回调写入，wait 之前不能搬动
+    for (size_t i = 0; i < tables.size(); ++i) {
+        const sstablehead &ssh = tables[i].iter.getTable();
+        if (ssh.getVersion() < 2)
+            continue;
+        std::vector<int> id{ssh.findBlock(key)};
+        if (id[0] == (int)ssh.getBlockCnt())
+            continue;
+        store->readBlocksAsync(ssh, id, io, [&first, i](size_t, const blockHandle &block) { first[i] = block; });
+    }
+    io.wait();
+    for (size_t i = 0; i < tables.size(); ++i) {
+        tableiter &it = tables[i].iter;
+        it.seek(key, first[i]);
+        if (fwd)
+            continue;
+        if (!it.valid())
+            it.seekToLast();
+        else if (it.key() > key)
+            it.prev();
+    }
+}
+
+bool Iterator::resolve(uint64_t key) {
+    pending.clear();
+    std::string_view base;
+    bool hasBase = false, done = false;
+    auto take    = [&](std::string_view v) { // 返回 true 表示找到了基准值或者删除
+        if (isMerge(v)) {
+            pending.emplace_back(v); // 继续向更旧的数据找
+            return false;
+        }
+        if (v != DEL) {
+            base    = v;
+            hasBase = true;
+        }
+        return true;
+    };
+    if (mem.valid() && mem.key() == key) {
+        memval = mem.value();
+        done   = take(memval);
+    }
+    if (!done)
+        done = rangeCovers(*view->memRanges, key); // memtable 中的范围删除比所有 sstable 都新
+    for (size_t i = 0; i < tables.size() && !done; ++i) {
+        source &t = tables[i];
+        if (!t.iter.valid() || t.iter.key() != key)
+            continue;
+        for (const rangeEle &r : ranges) {
+            if (r.covers(key, t.time, t.level)) {
+                done = true;
+                break;
+            }
+        }
+        if (!done)
+            done = take(t.iter.valueView(scratch));
+    }
+    if (!pending.empty()) {
+        std::string b(base);
+        merged = mergeFold(store->mergeOp, key, hasBase ? &b : nullptr, pending);
+        val    = merged;
+        return true;
+    }
+    if (!hasBase || base.empty())
+        return false;
+    val = base;
+    return true;
+}
+
+void Iterator::findNext() {
+    for (;;) {
+        bool any     = mem.valid();
+        uint64_t key = any ? mem.key() : 0;
+        for (source &t : tables) {
+            if (t.iter.valid() && (!any || t.iter.key() < key)) {
+                key = t.iter.key();
+                any = true;
+            }
+        }
+        if (!any || key > upper) {
+            ok = false;
+            return;
+        }
+        cur = key;
+        if (resolve(key)) {
+            ok = true;
+            return;
+        }
+        if (mem.valid() && mem.key() == key) // 不可见：停在 key 上的来源都往后走一步
+            mem.next();
+        for (source &t : tables) {
+            if (t.iter.valid() && t.iter.key() == key)
+                t.iter.next();
+        }
+    }
+}
+
+void Iterator::findPrev() {
+    for (;;) {
+        bool any     = mem.valid();
+        uint64_t key = any ? mem.key() : 0;
+        for (source &t : tables) {
+            if (t.iter.valid() && (!any || t.iter.key() > key)) {
+                key = t.iter.key();
+                any = true;
+            }
+        }
+        if (!any || key < lower) {
+            ok = false;
+            return;
+        }
+        cur = key;
+        if (resolve(key)) {
+            ok = true;
+            return;
+        }
+        if (mem.valid() && mem.key() == key)
+            mem.prev();
+        for (source &t : tables) {
+            if (t.iter.valid() && t.iter.key() == key)
+                t.iter.prev();
+        }
+    }
+}
+
+void Iterator::seek(uint64_t key) {
+    refresh();
+    position(std::max(key, lower), true);
+    findNext();
+}
+
+void Iterator::seekToFirst() {
+    seek(lower);
+}
+
+void Iterator::seekToLast() {
+    refresh();
+    position(upper, false);
+    findPrev();
+}
+
+void Iterator::next() {
+    if (!ok)
+        return;
+    if (refresh() || !forward) { // 来源要按 cur 重新定位
+        if (cur == INF) {
+            ok = false;
+            return;
+        }
+        position(cur + 1, true);
+    } else {
+        if (mem.stale()) // memtable 改过，前后可能插入了新的 key
+            mem.seek(cur);
+        if (mem.valid() && mem.key() == cur)
+            mem.next();
+        for (source &t : tables) {
+            if (t.iter.valid() && t.iter.key() == cur)
+                t.iter.next();
+        }
+    }
+    findNext();
+}
+
+void Iterator::prev() {
+    if (!ok)
+        return;
+    if (refresh() || forward) {
+        if (cur == 0) {
+            ok = false;
+            return;
+        }
+        position(cur - 1, false);
+    } else {
+        if (mem.stale())
+            seekForPrev(mem, cur);
+        if (mem.valid() && mem.key() == cur)
+            mem.prev();
+        for (source &t : tables) {
+            if (t.iter.valid() && t.iter.key() == cur)
+                t.iter.prev();
+        }
+    }
+    findPrev();
+}
@@ -0,0 +1,84 @@
+#pragma once
+
+#ifndef LSM_KV_ITERATOR_H
+#define LSM_KV_ITERATOR_H
+
+#include "skiplist.h"
+#include "tableiter.h"
+#include "tableset.h"
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+class KVStore;
+class Snapshot;
+
+/*
+ * 按 key 顺序遍历 store：memtable 和每张相交的 sstable 各一个迭代器，归并成一个。
+ * 同一个 key 只取可见的最新结果，删除、范围删除和 merge 的处理与 get 一致。
+ * 迭代器持有它读的版本和当前数据块，value() 直接指向块里的值，memtable 里的值复制一份。
+ * 写线程可以同时修改 store：装入了新版本时，下一次移动按当前 key 重新定位，之后看到的是新的数据。
+ * value() 在迭代器移动之前有效；迭代器只能在一个线程里用，不能比 store 活得久。
+ * 建在快照上的迭代器只读快照里的数据，不受之后的写入影响，要在快照释放之前销毁。
+ */
+class Iterator {
+    friend class KVStore;
+
+private:
+    struct source { // 一张 sstable 和它的新旧
+        tableiter iter;
+        uint64_t time;
+        int level;
+    };
+
+    KVStore *store;
+    const Snapshot *snap;                 // 为空时读 store 的当前版本
+    uint64_t lower, upper;                // 只返回 [lower, upper] 内的 key
+    std::shared_ptr<const tableset> view; // 建立 mem 和 tables 时的版本
+    memiter mem;
+    std::vector<source> tables;    // 从新到旧
+    std::vector<rangeEle> ranges;  // sstable 中与 [lower, upper] 相交的范围删除
+
+    bool forward = true; // 各个来源停在 cur 之后（true）还是之前
+    bool ok      = false;
+    uint64_t cur = 0;
+    std::string_view val;
+    std::string scratch, merged;      // v1 表读出的 value；merge 之后的结果
+    std::string memval;               // memtable 里当前 key 的值
+    std::vector<std::string> pending; // 当前 key 还没有找到基准值的 merge 串，从新到旧
+
+    Iterator(KVStore *store, uint64_t lower, uint64_t upper, const Snapshot *snap);
+
+    bool refresh();                      // 版本变了就重建 mem 和 tables，返回 true
+    void position(uint64_t key, bool fwd); // 每个来源停在第一个 >= key（fwd）或最后一个 <= key 的记录
+    bool resolve(uint64_t key);          // 算出 key 的可见值放进 val，不可见返回 false
+    void findNext();                     // 从各个来源的最小 key 起找第一个可见的 key
+    void findPrev();
+
+public:
+    Iterator(const Iterator &)            = delete;
+    Iterator &operator=(const Iterator &) = delete;
+
+    void seek(uint64_t key); // 第一个 >= key 的可见 key
+    void seekToFirst();
+    void seekToLast();
+    void next();
+    void prev();
+
+    bool valid() const {
+        return ok;
+    }
+
+    uint64_t key() const {
+        return cur;
+    }
+
+    std::string_view value() const {
+        return val;
+    }
+};
+
+#endif // LSM_KV_ITERATOR_H
@@ -5,20 +5,27 @@
 #include "utils.h"
 
 #include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <condition_variable>
+#include <cstdio>
 #include <cstdlib>
+#include <cstring>
+#include <fstream>
 #include <iostream>
-#include <queue>
 #include <set>
 #include <string>
+#include <thread>
 #include <utility>
 #include <cmath>
 
 const uint32_t MAXSIZE       = 2 * 1024 * 1024;
 
 
-KVStore::KVStore(const std::string &dir) :
-    KVStoreAPI(dir) // read from sstables
+KVStore::KVStore(const std::string &dir, mergeOperator op) :
+    KVStoreAPI(dir), mergeOp(op) // read from sstables
 {
+    recoverCompaction(dir);
     for (totalLevel = 0;; ++totalLevel) {
         std::string path = dir + "/level-" + std::to_string(totalLevel) + "/";
         std::vector<std::string> files;
@@ -27,141 +34,616 @@ KVStore::KVStore(const std::string &dir) :
             break; // stop read
         }
         int nums = utils::scanDir(path, files);
-        sstablehead cur;
         for (int i = 0; i < nums; ++i) {       // 读每一个文件头
             std::string url = path + files[i]; // url, 每一个文件名
-            cur.loadFileHead(url.data());
+            if (url.size() > 4 && url.compare(url.size() - 4, 4, ".tmp") == 0) {
+                utils::rmfile(url.data()); // flush 时没有写完的表
+                continue;
+            }
+            auto cur        = std::make_shared<sstablehead>();
+            cur->loadFileHead(url.data());
+            cur->setFileId(++fileSeq);
             sstableIndex[totalLevel].push_back(cur);
-            TIME = std::max(TIME, cur.getTime()); // 更新时间戳
+            TIME = std::max(TIME, cur->getTime()); // 更新时间戳
         }
     }
+    if (totalLevel >= 0) // get 从后往前查 0 层，需要按时间戳排好
+        std::sort(sstableIndex[0].begin(), sstableIndex[0].end(), [](const tableHandle &a, const tableHandle &b) {
+            return *a < *b;
+        });
+    for (int level = 1; level <= totalLevel; ++level) // 其余各层互不相交，按 key 排好以便二分
+        std::sort(sstableIndex[level].begin(), sstableIndex[level].end(),
+                  [](const tableHandle &a, const tableHandle &b) { return a->getMinV() < b->getMinV(); });
+
+    if (!utils::dirExists(dir))
+        utils::mkdir(dir.data());
+    log = new wal(dir + "/wal.log");
+    uint64_t flushed = 0; // 0 层最新的表，日志清空之后 flush 出来的表比日志记下的时间戳新
+    for (const tableHandle &t : sstableIndex[0])
+        flushed = std::max(flushed, t->getTime());
+    bool done = false, any = false;
+    log->replay([&](uint8_t type, uint64_t key, const std::string &val) { // 恢复崩溃前没有落盘的写入
+        if (type == wal::OP_EPOCH) {
+            done = key < flushed; // flush 之后、清空日志之前崩溃：merge 重放两次会重复累加
+            return;
+        }
+        any = true;
+        if (done)
+            return;
+        if (type == wal::OP_DELRANGE) {
+            uint64_t end;
+            std::memcpy(&end, val.data(), 8);
+            s->delRange(key, end);
+        } else if (type == wal::OP_MERGE) {
+            s->insert(key, mergeMem(key, val));
+            staleVec.insert(key);
+        } else
+            s->insert(key, type == wal::OP_DEL ? DEL : val);
+    });
+    if (done || !any) // 已经 flush 过的日志直接清空；空的日志补上时间戳
+        log->truncate(TIME);
+    install();
 }
 
 KVStore::~KVStore()
 {
-    sstable ss(s);
-    if (!ss.getCnt())
+    for (const Snapshot *snap : snapshots) // 没有释放的快照到这里就失效了
+        delete snap;
+    snapshots.clear();
+    frozen.reset();
+    flushMem();
+    current.store(nullptr); // 其他线程手里还有版本时，由它们释放
+    releaseObsolete();
+    delete log;
+}
+
+/**
+ * Flush the memtable into a new level-0 sstable, then truncate the WAL
+ * since everything it protects is now on disk. The truncate happens
+ * before compaction; a crash before it is detected on replay by the
+ * log's epoch, which is older than the new table.
+ */
+void KVStore::flushMem() {
+    sstable ss(s.get(), filterType, levelBitsPerKey(0));
+    if (ss.empty())
         return; // empty sstable
-    std::string path = std::string("./data/level-0/");
+    std::string url  = ss.getFilename();
+    std::string path = "./data/level-0";
     if (!utils::dirExists(path)) {
-        utils::_mkdir(path.data());
-        totalLevel = 0;
+        utils::mkdir(path.data());
+        totalLevel = std::max(totalLevel, 0);
     }
-    ss.putFile(ss.getFilename().data());
-    compaction(); // 从0层开始尝试合并
+    // 写完再改名：0 层出现的表一定是完整的，重放日志时才能据此判断日志已经 flush 过
+    std::string tmp = url + ".tmp";
+    ss.putFile(tmp.data(), log->getMode() != SYNC_NONE); // 加入磁盘，日志要同步时 sstable 也要落盘
+    std::rename(tmp.data(), url.data());
+    if (log->getMode() != SYNC_NONE)
+        utils::syncDir(path.data()); // 目录项也要落盘，之后才能清空日志
+    addsstable(ss, 0);                                     // 加入缓存，v2 的稀疏索引在写文件时生成
+    s = std::make_shared<skiplist>(0.5);                   // 旧的 memtable 留给还在读它的版本
+    frozen.reset();
+    install();                                             // 新表和空的 memtable 一起换上
+    log->truncate(TIME);                                   // 新表的时间戳就是最新的
+    compaction();                                          // 从0层开始尝试合并
+    releaseObsolete();
 }
 
 /**
- * Insert/Update the key-value pair.
- * No return values for simplicity.
+ * Append one entry to the WAL and insert it into the memtable, flushing the
+ * memtable first if the entry would not fit. Caller must hold writeLock.
+ * Returns the WAL sequence number to pass to wal::sync.
  */
-void KVStore::put(uint64_t key, const std::string &val) {
+uint64_t KVStore::writeMem(uint8_t type, uint64_t key, const std::string &val) {
+    if (memFull(key, val)) // 超过 2MB, 先落盘，再写日志
+        flushMem();
+
+    wal::record rec;
+    rec.add(type, key, type == wal::OP_DEL ? "" : val);
+    uint64_t seq = log->append(rec);
+    s->insert(key, val);
+    lastSeq++;
+    rowCache.erase(key); // 插入 memtable 之后再失效，正在读旧值的 get 不会把它放回缓存
+    return seq;
+}
+
+bool KVStore::memFull(uint64_t key, const std::string &val) {
     uint32_t nxtsize = s->getBytes();
+    uint64_t keys    = s->getCount();
     std::string res  = s->search(key);
     if (!res.length()) { // new add
         nxtsize += 12 + val.length();
+        keys++;
     } else
         nxtsize = nxtsize - res.length() + val.length(); // change string
-    if (nxtsize + 10240 + 32 <= MAXSIZE)
-        s->insert(key, val); // 小于等于（不超过） 2MB
-    else {
-        sstable ss(s);
-        s->reset();
-        std::string url  = ss.getFilename();
-        std::string path = "./data/level-0";
-        if (!utils::dirExists(path)) {
-            utils::mkdir(path.data());
-            totalLevel = 0;
-        }
-        addsstable(ss, 0);      // 加入缓存
-        ss.putFile(url.data()); // 加入磁盘
-        compaction();
-        s->insert(key, val);
-    }
+    return memOver(nxtsize, keys);
+}
+
+/**
+ * Check whether a level-0 table holding keys entries and bytes of index,
+ * data and range tombstones would exceed MAXSIZE once the header and the
+ * filters are added. Keys reach the memtable out of order, so each one is
+ * counted as a new prefix at every range filter level.
+ */
+bool KVStore::memOver(uint32_t bytes, uint64_t keys) const {
+    return bytes + sstable::headBytes(keys, RANGE_LEVELS * keys, filterType, levelBitsPerKey(0)) > MAXSIZE;
+}
+
+/**
+ * Compute the memtable value after merging operand into key, using only
+ * what the memtable holds. An older value in the memtable is folded right
+ * away; otherwise the operand is kept until a read or compaction finds
+ * the base value.
+ */
+std::string KVStore::mergeMem(uint64_t key, const std::string &operand) {
+    std::string res = s->search(key);
+    if (isMerge(res) || (res.empty() && !s->covered(key)))
+        return mergeAppend(res, operand);
+    return mergeOp(key, (res.empty() || res == DEL) ? nullptr : &res, operand);
+}
 
+void KVStore::setSyncMode(SYNCMODE mode) {
+    log->setMode(mode);
+}
+
+/**
+ * Insert/Update the key-value pair.
+ * No return values for simplicity.
+ */
+void KVStore::put(uint64_t key, const std::string &val) {
     std::vector<std::vector<float>> new_vec = embedding(val);
-    std::vector<vecele>::iterator it = std::find(vecArray.begin(), vecArray.end(), key);
-    if (it == vecArray.end()) {
-        vecArray.emplace_back(vecele(key, new_vec[0]));
+
+    std::unique_lock<std::mutex> lock(writeLock);
+    uint64_t seq = writeMem(wal::OP_PUT, key, val);
+    staleVec.erase(key);
+
+    std::vector<vecele> &vecList     = ownVecs();
+    std::vector<vecele>::iterator it = std::find(vecList.begin(), vecList.end(), key);
+    if (it == vecList.end()) {
+        vecList.emplace_back(vecele(key, new_vec[0]));
     }
     else {
         *it = vecele(key, new_vec[0]);
     }
+    lock.unlock();
+
+    log->sync(seq); // 落盘之后才算写入成功，组提交时在锁外等待
+}
+
+/**
+ * Apply all entries of the batch atomically: one WAL record, one pass over
+ * the memtable, and a single size check. The check is done up front so the
+ * whole batch lands in one memtable and level-0 tables stay within 2MB.
+ * A batch that would not fit in a level-0 table even on its own is
+ * rejected: nothing is written and false is returned.
+ */
+bool KVStore::write(const WriteBatch &batch) {
+    if (!batch.count())
+        return true;
+
+    // 一次 embedding 调用算出整批 value 的向量（按行切分），value 含换行时只能逐个算
+    std::string prompts;
+    bool joinable = true;
+    int puts      = 0;
+    for (const auto &e : batch.entries) {
+        if (e.isDel)
+            continue;
+        if (e.value.find('\n') != std::string::npos)
+            joinable = false;
+        prompts += (puts++ ? "\n" : "") + e.value;
+    }
+    std::vector<std::vector<float>> vecs;
+    if (joinable && puts) {
+        vecs = embedding(prompts);
+    } else {
+        for (const auto &e : batch.entries) {
+            if (!e.isDel)
+                vecs.push_back(embedding(e.value)[0]);
+        }
+    }
+
+    std::unique_lock<std::mutex> lock(writeLock);
+    if (memOver(batch.bytes, batch.count())) { // 拆开写就不是原子的了
+        std::cerr << "Error: write batch of " << batch.bytes << " bytes does not fit in one sstable" << std::endl;
+        return false;
+    }
+    if (memOver(s->getBytes() + batch.bytes, s->getCount() + batch.count()))
+        flushMem();
+
+    wal::record rec;
+    for (const auto &e : batch.entries)
+        rec.add(e.isDel ? wal::OP_DEL : wal::OP_PUT, e.key, e.isDel ? "" : e.value);
+    uint64_t seq = log->append(rec);
+    lastSeq += batch.count();
+
+    std::vector<vecele> &vecList = ownVecs();
+    int p                        = 0;
+    beginApply();
+    for (const auto &e : batch.entries) {
+        s->insert(e.key, e.value);
+        rowCache.erase(e.key);
+        staleVec.erase(e.key);
+        std::vector<vecele>::iterator it = std::find(vecList.begin(), vecList.end(), e.key);
+        if (e.isDel) {
+            if (it != vecList.end())
+                vecList.erase(it);
+        } else if (it == vecList.end()) {
+            vecList.emplace_back(vecele(e.key, vecs[p++]));
+        } else {
+            *it = vecele(e.key, vecs[p++]);
+        }
+    }
+    endApply();
+    lock.unlock();
+
+    log->sync(seq);
+    return true;
 }
 
 /**
  * Returns the (string) value of the given key.
  * An empty string indicates not found.
  */
-std::string KVStore::get(uint64_t key) //
-{
-    uint64_t time = 0;
-    int goalOffset;
-    uint32_t goalLen;
-    std::string goalUrl;
-    std::string res = s->search(key);
+std::string KVStore::get(uint64_t key) {
+    std::string res;
+    uint64_t epoch = 0;
+    if (rowCache.lookup(key, res, epoch))
+        return res;
+    res = readKey(key, *viewOf(nullptr));
+    rowCache.insert(key, res, epoch); // 没找到也缓存，空串
+    return res;
+}
+
+/**
+ * Returns the value of key as of snap, or as of now when snap is null.
+ * Reads through a snapshot skip the row cache, which only holds current
+ * values.
+ */
+std::string KVStore::get(uint64_t key, const Snapshot *snap) {
+    if (!snap)
+        return get(key);
+    return readKey(key, *viewOf(snap));
+}
+
+/**
+ * Look the key up in the memtable and the sstables, folding merge
+ * operands on the way down. Bypasses the row cache.
+ */
+std::string KVStore::readKey(uint64_t key, const tableset &view) {
+    std::vector<std::string> pending; // 还没有找到基准值的 merge 串，从新到旧
+    bool hasBase = false;
+    std::string res = view.mem->search(key);
     if (res.length()) { // 在memtable中找到, 或者是deleted，说明最近被删除过，
                         // 不用查sstable
         if (res == DEL)
             return "";
-        return res;
+        if (!isMerge(res))
+            return res;
+        pending.push_back(res);
     }
-    for (int level = 0; level <= totalLevel; ++level) {
-        for (sstablehead it : sstableIndex[level]) {
+    bool done = rangeCovers(*view.memRanges, key); // 被 memtable 中的范围删除覆盖
+    keyHash h = bloom::hash(key); // 所有过滤器共用
+    for (int level = 0; level <= view.top() && !done; ++level) {
+        const std::vector<tableHandle> &tables = view.levels[level];
+        size_t lo = 0, hi = tables.size();
+        uint64_t maybe = 0; // 0 层: 第 i 位表示第 i 张表的过滤器通过
+        if (level) { // 非 0 层二分出唯一可能包含 key 的表
+            lo = findTable(tables, key);
+            hi = std::min(lo + 1, hi);
+        } else
+            maybe = probeLevel0(tables, key, h);
+        for (size_t i = hi; i-- > lo;) { // 0 层从新到旧
+            const sstablehead &it = *tables[i];
             if (key < it.getMinV() || key > it.getMaxV())
                 continue;
-            uint32_t len;
-            int offset = it.searchOffset(key, len);
-            if (offset == -1) {
-                if (level == 0)
-                    continue;
-                else
+            bool pass = (level || i >= 64) ? it.mayContain(h) : (maybe >> i) & 1;
+            if (pass && searchTable(it, key, res)) {
+                if (!isMerge(res)) {
+                    hasBase = res != DEL;
+                    done    = true;
                     break;
+                }
+                pending.push_back(res); // 继续向更旧的数据找基准值
             }
-            // sstable ss;
-            // ss.loadFile(it.getFilename().data());
-            if (it.getTime() > time) { // find the latest head
-                time       = it.getTime();
-                goalUrl    = it.getFilename();
-                goalOffset = offset + 32 + 10240 + 12 * it.getCnt();
-                goalLen    = len;
+            if (it.covered(key)) { // 同一张表里的点比范围删除新
+                done = true;
+                break;
             }
         }
-        if (time)
-            break; // only a test for found
     }
-    if (!goalUrl.length())
-        return ""; // not found a sstable
-    res = fetchString(goalUrl, goalOffset, goalLen);
-    if (res == DEL)
-        return "";
+    if (pending.empty()) {
+        if (!hasBase)
+            return "";
+        return res; // 直接移动，不再复制
+    }
+    return mergeFold(mergeOp, key, hasBase ? &res : nullptr, pending);
+}
+
+/**
+ * Look up many keys at once. Returns the values in the order of keys, an
+ * empty string for keys not found.
+ *
+ * Keys are sorted first so the memtable is searched in one ordered pass
+ * and each sstable is visited once for all the keys it may hold: filters
+ * are probed together, and the data blocks those keys need are read with
+ * one pread per run of adjacent blocks. A write batch or range delete
+ * running at the same time is seen entirely or not at all.
+ */
+std::vector<std::string> KVStore::multi_get(const std::vector<uint64_t> &keys) {
+    std::vector<uint64_t> sorted(keys);
+    std::sort(sorted.begin(), sorted.end());
+    sorted.erase(std::unique(sorted.begin(), sorted.end()), sorted.end());
+
+    struct lookup {
+        std::string res;
+        std::vector<std::string> pending; // 还没有找到基准值的 merge 串，从新到旧
+        bool hasBase = false, done = false, cached = false;
+        bool failed = false; // 有块没读出来，结果不放进行缓存
+        uint64_t epoch = 0;
+        keyHash h;
+    };
+    std::vector<lookup> st;
+    std::vector<uint64_t> memKeys; // 行缓存没有命中的 key，仍然升序
+    std::shared_ptr<const tableset> view;
+    std::vector<std::string> vals;
+    for (;;) { // 和 WriteBatch、范围删除重叠时重读，它们的修改要么全看到要么都看不到
+        uint64_t start = applying.load(std::memory_order_acquire);
+        if (start & 1) {
+            std::this_thread::yield();
+            continue;
+        }
+        st.assign(sorted.size(), lookup());
+        memKeys.clear();
+        for (size_t i = 0; i < sorted.size(); ++i) {
+            st[i].cached = st[i].done = rowCache.lookup(sorted[i], st[i].res, st[i].epoch);
+            if (!st[i].done)
+                memKeys.push_back(sorted[i]);
+        }
+        view = viewOf(nullptr);
+        view->mem->searchSorted(memKeys, vals);
+        if (applying.load(std::memory_order_acquire) == start)
+            break;
+    }
+    std::vector<size_t> todo; // 还要查 sstable 的 key 在 sorted 中的下标，升序
+    for (size_t i = 0, m = 0; i < sorted.size(); ++i) {
+        if (st[i].done)
+            continue;
+        lookup &l          = st[i];
+        std::string &found = vals[m++];
+        if (found.length()) { // 与 get 相同：删除标记或完整的值直接结束
+            if (found == DEL) {
+                l.done = true;
+                continue;
+            }
+            if (!isMerge(found)) {
+                l.res     = std::move(found);
+                l.hasBase = l.done = true;
+                continue;
+            }
+            l.pending.push_back(std::move(found));
+        }
+        if (rangeCovers(*view->memRanges, sorted[i])) {
+            l.done = true;
+            continue;
+        }
+        l.h = bloom::hash(sorted[i]);
+        todo.push_back(i);
+    }
+
+    asyncreader &io = asyncreader::local();
+    std::deque<tableBatch> batches; // 读块的回调引用其中的元素，不能搬动；各层复用，留着 vector 的容量
+    size_t used = 0;
+    auto apply = [&](tableBatch &batch) { // 块已经查完：收下结果，再看范围删除
+        if (batch.failed) {
+            for (size_t i : batch.idx)
+                st[i].failed = true;
+        }
+        for (size_t c = 0; c < batch.keys.size(); ++c) {
+            if (!batch.hit[c])
+                continue;
+            lookup &l = st[batch.idx[c]];
+            if (!isMerge(batch.vals[c])) {
+                l.hasBase = batch.vals[c] != DEL;
+                l.res     = std::move(batch.vals[c]);
+                l.done    = true;
+            } else
+                l.pending.push_back(std::move(batch.vals[c])); // 继续向更旧的数据找基准值
+        }
+        for (size_t p = batch.from; p < batch.to; ++p) {
+            if (batch.ssh->covered(sorted[todo[p]])) // 同一张表里的点比范围删除新
+                st[todo[p]].done = true;
+        }
+    };
+    auto resolved = [&](size_t i) { return st[i].done; };
+    for (int level = 0; level <= view->top() && !todo.empty(); ++level) {
+        const std::vector<tableHandle> &tables = view->levels[level];
+        size_t lo = 0, hi = tables.size();
+        if (level) { // 非 0 层的表按 key 有序、互不相交，只看覆盖 todo 的那一段
+            lo = findTable(tables, sorted[todo.front()]);
+            hi = std::min(findTable(tables, sorted[todo.back()]) + 1, hi);
+        }
+        used = 0;
+        for (size_t t = hi; t-- > lo && !todo.empty();) { // 0 层从新到旧
+            const sstablehead &ssh = *tables[t];
+            auto first = std::lower_bound(todo.begin(), todo.end(), ssh.getMinV(),
+                                          [&](size_t i, uint64_t key) { return sorted[i] < key; });
+            auto last  = std::upper_bound(first, todo.end(), ssh.getMaxV(),
+                                          [&](uint64_t key, size_t i) { return key < sorted[i]; });
+            if (first == last)
+                continue;
+            for (auto it = first; it != last; ++it) // 先把这张表要看的过滤器位置都预取
+                ssh.prefetchFilter(st[*it].h);
+            if (used == batches.size())
+                batches.emplace_back();
+            tableBatch &batch = batches[used++];
+            batch.reset(&ssh, first - todo.begin(), last - todo.begin());
+            for (auto it = first; it != last; ++it) {
+                if (ssh.mayContain(st[*it].h)) {
+                    batch.idx.push_back(*it);
+                    batch.keys.push_back(sorted[*it]);
+                }
+            }
+            loadBatch(batch, io);
+            if (!level) { // 0 层的表有新旧之分，逐张读完再看下一张
+                io.wait();
+                apply(batch);
+                todo.erase(std::remove_if(first, last, resolved), last);
+                used = 0;
+            }
+        }
+        if (level) { // 同一层的表互不相交，所有的读一起在途
+            io.wait();
+            for (size_t b = 0; b < used; ++b)
+                apply(batches[b]);
+            todo.erase(std::remove_if(todo.begin(), todo.end(), resolved), todo.end());
+        }
+    }
+
+    for (size_t i = 0; i < sorted.size(); ++i) {
+        lookup &l = st[i];
+        if (l.cached)
+            continue;
+        if (!l.pending.empty())
+            l.res = mergeFold(mergeOp, sorted[i], l.hasBase ? &l.res : nullptr, l.pending);
+        else if (!l.hasBase)
+            l.res.clear();
+        if (!l.failed)
+            rowCache.insert(sorted[i], l.res, l.epoch);
+    }
+
+    std::vector<size_t> at(keys.size());
+    std::vector<uint32_t> uses(sorted.size()); // 重复的 key 复制，最后一次移动
+    for (size_t i = 0; i < keys.size(); ++i) {
+        at[i] = std::lower_bound(sorted.begin(), sorted.end(), keys[i]) - sorted.begin();
+        uses[at[i]]++;
+    }
+    std::vector<std::string> res(keys.size());
+    for (size_t i = 0; i < keys.size(); ++i)
+        res[i] = --uses[at[i]] ? st[at[i]].res : std::move(st[at[i]].res);
     return res;
 }
 
 /**
  * Delete the given key-value pair if it exists.
  * Returns false iff the key is not found.
+ * In blind-delete mode the lookup is skipped and true is always returned.
  */
 bool KVStore::del(uint64_t key) {
+    if (blindDelete) {
+        del_blind(key);
+        return true;
+    }
+
     std::string res = get(key);
 
     if (!res.length())
         return false; // not exist
 
-    put(key, DEL);    // put a del marker
+    del_blind(key);
+    return true;
+}
+
+/**
+ * Write a tombstone for the key without looking it up first. Deleting a
+ * missing key only costs a memtable entry, which compaction drops at the
+ * last level.
+ */
+void KVStore::del_blind(uint64_t key) {
+    std::unique_lock<std::mutex> lock(writeLock);
+    uint64_t seq = writeMem(wal::OP_DEL, key, DEL); // put a del marker
+    staleVec.erase(key);
 
-    std::vector<vecele>::iterator it = std::find(vecArray.begin(), vecArray.end(), key);
-    vecArray.erase(it);
+    std::vector<vecele> &vecList     = ownVecs();
+    std::vector<vecele>::iterator it = std::find(vecList.begin(), vecList.end(), key);
+    if (it != vecList.end()) // 重启后恢复的数据没有向量
+        vecList.erase(it);
+    lock.unlock();
 
-    return true;
+    log->sync(seq);
+}
+
+/**
+ * Delete every key in [key1, key2] with a single range tombstone. Older
+ * memtable entries in the range are dropped right away; entries on disk
+ * are hidden from get/scan and removed physically by compaction.
+ */
+void KVStore::del_range(uint64_t key1, uint64_t key2) {
+    if (key1 > key2)
+        return;
+
+    std::unique_lock<std::mutex> lock(writeLock);
+    if (memOver(s->getBytes() + 16, s->getCount()))
+        flushMem();
+
+    wal::record rec;
+    rec.add(wal::OP_DELRANGE, key1, std::string(reinterpret_cast<const char *>(&key2), 8));
+    uint64_t seq = log->append(rec);
+    beginApply();
+    s->delRange(key1, key2);
+    install(); // 读者要看到新的范围删除
+    rowCache.clear(); // 范围内缓存的 key 不好逐个找，整个清空
+    endApply();
+    lastSeq++;
+    staleVec.erase(staleVec.lower_bound(key1), staleVec.upper_bound(key2));
+
+    std::vector<vecele> &vecList = ownVecs();
+    vecList.erase(
+        std::remove_if(
+            vecList.begin(),
+            vecList.end(),
+            [&](const vecele &v) { return key1 <= v.key && v.key <= key2; }
+        ),
+        vecList.end()
+    );
+    lock.unlock();
+
+    log->sync(seq);
+}
+
+/**
+ * Merge operand into the value of key without reading it. Only the
+ * operand goes to the WAL; replay recomputes the memtable value with the
+ * operator passed to the constructor.
+ */
+void KVStore::merge(uint64_t key, const std::string &operand) {
+    std::unique_lock<std::mutex> lock(writeLock);
+    std::string val = mergeMem(key, operand);
+    if (memFull(key, val)) {
+        flushMem();
+        val = mergeMem(key, operand); // memtable 已经清空，重新计算
+    }
+
+    wal::record rec;
+    rec.add(wal::OP_MERGE, key, operand);
+    uint64_t seq = log->append(rec);
+    s->insert(key, val);
+    lastSeq++;
+    rowCache.erase(key);
+    staleVec.insert(key);
+    lock.unlock();
+
+    log->sync(seq);
+}
+
+void KVStore::setMergeOperator(mergeOperator op) {
+    std::lock_guard<std::mutex> lock(writeLock);
+    mergeOp = op;
+    rowCache.clear(); // 缓存的是旧操作符合并出来的值
+}
+
+void KVStore::setBlindDelete(bool blind) {
+    blindDelete = blind;
 }
 
 /**
  * This resets the kvstore. All key-value pairs should be removed,
  * including memtable and all sstables files.
+ * Snapshots must be released first: their tables are deleted here.
  */
 void KVStore::reset() {
-    s->reset(); // 先清空memtable
+    std::lock_guard<std::mutex> lock(writeLock);
+    s = std::make_shared<skiplist>(0.5); // 先清空memtable
+    frozen.reset();
+    log->truncate(TIME);
     std::vector<std::string> files;
     for (int level = 0; level <= totalLevel; ++level) { // 依层清空每一层的sstables
         std::string path = std::string("./data/level-") + std::to_string(level);
@@ -173,8 +655,96 @@ void KVStore::reset() {
         utils::rmdir(path.data());
         sstableIndex[level].clear();
     }
-    vecArray.clear();
+    tableCache.clear();
+    obsolete.clear(); // 表缓存清空时已经关掉了它们的 fd
+    blockCache.clear();
+    rowCache.clear();
+    ownVecs().clear();
+    staleVec.clear();
     totalLevel = -1;
+    install();
+}
+
+std::unique_ptr<Iterator> KVStore::new_iterator(uint64_t lower, uint64_t upper, const Snapshot *snap) {
+    return std::unique_ptr<Iterator>(new Iterator(this, lower, upper, snap));
+}
+
+/**
+ * Take a read-only view of the store as it is now. Reads through it see
+ * every write made before the call and none after, across flushes and
+ * compactions, until release_snapshot.
+ *
+ * The memtable is copied once; snapshots taken with no write in between
+ * share the copy. Tables are shared by reference: one that compaction
+ * replaces is unlinked as usual but its fd stays open until the last
+ * snapshot or iterator holding it goes away.
+ */
+const Snapshot *KVStore::get_snapshot() {
+    std::lock_guard<std::mutex> lock(writeLock);
+    if (!frozen || frozenVersion != s->getVersion()) {
+        frozen        = std::make_shared<skiplist>(*s);
+        frozenVersion = s->getVersion();
+    }
+    auto view       = std::make_shared<tableset>();
+    view->mem       = frozen;
+    view->memRanges = frozen->shareRanges();
+    view->levels.assign(sstableIndex, sstableIndex + totalLevel + 1);
+    Snapshot *snap = new Snapshot();
+    snap->seq      = lastSeq;
+    snap->view     = view;
+    snap->vecs     = vecArray;
+    snap->staleVec = staleVec;
+    snapshots.insert(snap);
+    return snap;
+}
+
+void KVStore::release_snapshot(const Snapshot *snap) {
+    std::lock_guard<std::mutex> lock(writeLock);
+    if (!snapshots.erase(snap)) {
+        std::cerr << "Error: release of unknown snapshot" << std::endl;
+        return;
+    }
+    delete snap;
+    if (frozen.use_count() == 1 && frozenVersion != s->getVersion()) // 没有快照在用，memtable 也改过了
+        frozen.reset();
+    releaseObsolete();
+}
+
+std::shared_ptr<const tableset> KVStore::viewOf(const Snapshot *snap) const {
+    if (snap)
+        return snap->view;
+    return current.load(std::memory_order_acquire);
+}
+
+/**
+ * Publish the memtable and the writer's sstableIndex as the new current
+ * version. Readers that already hold the old one keep reading it; the
+ * tables it alone references are closed by releaseObsolete once the last
+ * reader lets go. Caller must hold writeLock or be the constructor.
+ */
+void KVStore::install() {
+    auto next       = std::make_shared<tableset>();
+    next->mem       = s;
+    next->memRanges = s->shareRanges();
+    next->levels.assign(sstableIndex, sstableIndex + totalLevel + 1);
+    current.store(std::move(next), std::memory_order_release);
+}
+
+/**
+ * Bracket a change that touches several memtable entries: a WriteBatch or
+ * a range delete with its new tombstone list. multi_get reads the row
+ * cache and the memtable between two loads of applying and starts over
+ * when they differ or the first is odd, so it sees such a change entirely
+ * or not at all. get reads a single entry and needs no retry. Caller must
+ * hold writeLock.
+ */
+void KVStore::beginApply() {
+    // 之后对跳表、版本和行缓存的修改都是 release 写，读者读到其中任何一个，再读 applying 就不会是旧值
+    applying.store(applying.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+}
+
+void KVStore::endApply() {
+    applying.store(applying.load(std::memory_order_relaxed) + 1, std::memory_order_release);
 }
 
 /**
@@ -182,95 +752,181 @@ void KVStore::reset() {
  * keys in the list should be in an ascending order.
  * An empty string indicates not found.
  */
+void KVStore::scan(uint64_t key1, uint64_t key2, std::list<std::pair<uint64_t, std::string>> &list) {
+    scan(key1, key2, list, SIZE_MAX);
+}
 
-struct myPair {
-    uint64_t key, time;
-    int id, index;
-    std::string filename;
+/**
+ * Same as scan, but stops after limit rows; the rest of the range is
+ * never read.
+ */
+void KVStore::scan(uint64_t key1, uint64_t key2, std::list<std::pair<uint64_t, std::string>> &list, size_t limit,
+                   const Snapshot *snap) {
+    std::unique_ptr<Iterator> it = new_iterator(key1, key2, snap);
+    size_t rows = 0;
+    for (it->seek(key1); it->valid() && rows < limit; it->next(), ++rows)
+        list.emplace_back(it->key(), it->value());
+}
 
-    myPair(uint64_t key, uint64_t time, int index, int id,
-           std::string file) { // construct function
-        this->time     = time;
-        this->key      = key;
-        this->id       = id;
-        this->index    = index;
-        this->filename = file;
-    }
-};
 
-struct cmp {
-    bool operator()(myPair &a, myPair &b) {
-        if (a.key == b.key)
-            return a.time < b.time;
-        return a.key > b.key;
+/**
+ * Split [key1, key2] into at most parts ranges that hold about the same
+ * amount of sstable data, so each parallel_scan worker gets a similar
+ * share. Split points are fence keys: the last key of each v2 data block,
+ * or every few index entries of a v1 table, weighted by the bytes before
+ * them. Returns the inclusive end of each range in order; the last one
+ * is key2.
+ */
+std::vector<uint64_t> KVStore::splitRange(const tableset &view, uint64_t key1, uint64_t key2, size_t parts) {
+    std::vector<std::pair<uint64_t, uint64_t>> fences; // (key, 它之前那段数据的字节数)
+    auto collect = [&](const sstablehead &ssh) {
+        if (ssh.getMaxV() < key1 || ssh.getMinV() > key2)
+            return;
+        if (ssh.getVersion() >= 2) {
+            for (size_t b = ssh.findBlock(key1); b < ssh.getBlockCnt(); ++b) {
+                blockIndex bi = ssh.getBlock(b);
+                fences.emplace_back(std::min(bi.lastKey, key2), bi.size);
+                if (bi.lastKey >= key2)
+                    break;
+            }
+            return;
+        }
+        int cnt  = ssh.getCnt();
+        int step = std::max(1, cnt / 64); // 老格式没有数据块，按 key 的下标取样
+        for (int p = ssh.lowerBound(key1), from = p; p < cnt; p = std::min(p + step, cnt - 1)) {
+            fences.emplace_back(std::min(ssh.getKey(p), key2), ssh.getOffset(p) - ssh.getOffset(from - 1));
+            from = p + 1;
+            if (ssh.getKey(p) >= key2 || p == cnt - 1)
+                break;
+        }
+    };
+    for (int level = 0; level <= view.top(); ++level) {
+        const std::vector<tableHandle> &tables = view.levels[level];
+        size_t i = level ? findTable(tables, key1) : 0;
+        for (; i < tables.size() && (!level || tables[i]->getMinV() <= key2); ++i)
+            collect(*tables[i]);
+    }
+    std::sort(fences.begin(), fences.end());
+    uint64_t total = 0, acc = 0;
+    for (const auto &f : fences)
+        total += f.second;
+    std::vector<uint64_t> ends;
+    for (const auto &f : fences) {
+        acc += f.second;
+        if (ends.size() + 1 >= parts || f.first >= key2)
+            break;
+        if (acc * parts >= total * (ends.size() + 1) && (ends.empty() || f.first > ends.back()))
+            ends.push_back(f.first);
     }
-};
+    ends.push_back(key2);
+    return ends;
+}
 
+/**
+ * Scan [key1, key2] with several threads. The range is split at sstable
+ * fence keys into about threads * SCAN_PARTS_PER_THREAD parts of similar
+ * size, and each part is merged by its own Iterator on a worker thread.
+ *
+ * When ordered, rows reach callback on the calling thread in key order:
+ * workers fill per-part buffers and stay at most 2 * threads parts ahead
+ * of delivery, which bounds the memory held. Otherwise callback runs on
+ * the workers as rows are found, concurrently and in key order only
+ * within a part, so it must be thread-safe.
+ *
+ * Every part reads one snapshot taken on entry, so the rows are the store
+ * as it was when the call began, even while writes, flushes and
+ * compactions run alongside. Taking it copies the memtable unless an
+ * unchanged copy is already shared by another snapshot.
+ *
+ * @param threads Number of workers; 0 uses all hardware threads.
+ */
+void KVStore::parallel_scan(uint64_t key1, uint64_t key2, const scanCallback &callback, unsigned threads,
+                            bool ordered) {
+    if (key1 > key2)
+        return;
+    if (!threads)
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    // 所有分段读同一个快照，返回时释放
+    std::unique_ptr<const Snapshot, std::function<void(const Snapshot *)>> snap(
+        get_snapshot(), [this](const Snapshot *s) { release_snapshot(s); });
+    std::vector<uint64_t> ends =
+        splitRange(*viewOf(snap.get()), key1, key2, (size_t)threads * SCAN_PARTS_PER_THREAD);
+    size_t parts = ends.size();
+    auto lowerOf = [&](size_t i) { return i ? ends[i - 1] + 1 : key1; };
+    if (threads == 1 || parts == 1) {
+        std::unique_ptr<Iterator> it = new_iterator(key1, key2, snap.get());
+        for (it->seek(key1); it->valid(); it->next())
+            callback(it->key(), it->value());
+        return;
+    }
+    threads = std::min<size_t>(threads, parts);
 
-void KVStore::scan(uint64_t key1, uint64_t key2, std::list<std::pair<uint64_t, std::string>> &list) {
-    std::vector<std::pair<uint64_t, std::string>> mem;
-    // std::set<myPair> heap; // 维护一个指针最小堆
-    std::priority_queue<myPair, std::vector<myPair>, cmp> heap;
-    // std::vector<sstable> ssts;
-    std::vector<sstablehead> sshs;
-    s->scan(key1, key2, mem);   // add in mem
-    std::vector<int> head, end; // [head, end)
-    int cnt = 0;
-    if (mem.size())
-        heap.push(myPair(mem[0].first, INF, 0, -1, "qwq"));
-    for (int level = 0; level <= totalLevel; ++level) {
-        for (sstablehead it : sstableIndex[level]) {
-            if (key1 > it.getMaxV() || key2 < it.getMinV())
-                continue; // 无交集
-            int hIndex = it.lowerBound(key1);
-            int tIndex = it.lowerBound(key2);
-            if (hIndex < it.getCnt()) { // 此sstable可用
-                // sstable ss; // 读sstable
-                std::string url = it.getFilename();
-                // ss.loadFile(url.data());
-
-                heap.push(myPair(it.getKey(hIndex), it.getTime(), hIndex, cnt++, url));
-                head.push_back(hIndex);
-                if (it.search(key2) == tIndex)
-                    tIndex++; // tIndex为第一个不可的
-                end.push_back(tIndex);
-                // ssts.push_back(ss); // 加入ss
-                sshs.push_back(it);
+    std::atomic<size_t> nextPart(0);
+    std::vector<std::thread> workers;
+    if (!ordered) {
+        auto work = [&]() {
+            for (size_t i; (i = nextPart++) < parts;) {
+                std::unique_ptr<Iterator> it = new_iterator(lowerOf(i), ends[i], snap.get());
+                for (it->seek(lowerOf(i)); it->valid(); it->next())
+                    callback(it->key(), it->value());
             }
-        }
+        };
+        for (unsigned t = 1; t < threads; ++t)
+            workers.emplace_back(work);
+        work(); // 调用线程也干活
+        for (std::thread &w : workers)
+            w.join();
+        return;
     }
-    uint64_t lastKey = INF; // only choose the latest key
-    while (!heap.empty()) { // 维护堆
-        myPair cur = heap.top();
-        heap.pop();
-        if (cur.id >= 0) { // from sst
-            if (cur.key != lastKey) {
-                lastKey         = cur.key;
-                uint32_t start  = sshs[cur.id].getOffset(cur.index - 1);
-                uint32_t len    = sshs[cur.id].getOffset(cur.index) - start;
-                uint32_t scnt   = sshs[cur.id].getCnt();
-                std::string res = fetchString(cur.filename, 10240 + 32 + scnt * 12 + start, len);
-                if (res.length() && res != DEL)
-                    list.emplace_back(cur.key, res);
-            }
-            if (cur.index + 1 < end[cur.id]) { // add next one to heap
-                heap.push(myPair(sshs[cur.id].getKey(cur.index + 1), cur.time, cur.index + 1, cur.id, cur.filename));
-            }
-        } else { // from mem
-            if (cur.key != lastKey) {
-                lastKey         = cur.key;
-                std::string res = mem[cur.index].second;
-                if (res.length() && res != DEL)
-                    list.emplace_back(cur.key, mem[cur.index].second);
+
+    struct part {
+        std::vector<std::pair<uint64_t, std::string>> rows;
+        bool done = false;
+    };
+    std::vector<part> results(parts);
+    std::mutex mtx;
+    std::condition_variable cv;
+    size_t delivered = 0; // 已经交给 callback 的段数
+    auto work        = [&]() {
+        for (;;) {
+            size_t i;
+            {
+                std::unique_lock<std::mutex> lock(mtx);
+                cv.wait(lock, [&] { return nextPart >= parts || nextPart < delivered + 2 * threads; }); // 不要跑得太远
+                if (nextPart >= parts)
+                    return;
+                i = nextPart++;
             }
-            if (cur.index < mem.size() - 1) {
-                heap.push(myPair(mem[cur.index + 1].first, cur.time, cur.index + 1, -1, cur.filename));
+            std::unique_ptr<Iterator> it = new_iterator(lowerOf(i), ends[i], snap.get());
+            for (it->seek(lowerOf(i)); it->valid(); it->next())
+                results[i].rows.emplace_back(it->key(), it->value());
+            {
+                std::lock_guard<std::mutex> lock(mtx);
+                results[i].done = true;
             }
+            cv.notify_all();
         }
+    };
+    for (unsigned t = 0; t < threads; ++t)
+        workers.emplace_back(work);
+    for (size_t i = 0; i < parts; ++i) {
+        {
+            std::unique_lock<std::mutex> lock(mtx);
+            cv.wait(lock, [&] { return results[i].done; });
+        }
+        for (const auto &row : results[i].rows)
+            callback(row.first, row.second);
+        std::vector<std::pair<uint64_t, std::string>>().swap(results[i].rows); // 交出去的段马上释放
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            delivered = i + 1;
+        }
+        cv.notify_all();
     }
+    for (std::thread &w : workers)
+        w.join();
 }
 
-
 int maxLimit(int level) {
     return pow(2, level + 1);
 }
@@ -308,14 +964,39 @@ void MergeSort(std::vector<ele> &eleArr, std::vector<ele> &tmpArr, int startInde
     }
 }
 
-void removeDup(std::vector<ele> &eleArr) {
-    for (auto it = eleArr.begin(); it != eleArr.end();) {
-        auto it2 = it + 1;
-        while(it2 != eleArr.end() && it->key == it2->key) {
-            it2 = eleArr.erase(it2);
+/**
+ * Keep only the newest entry of each key. A newest merge entry is folded
+ * onto the first older non-merge entry; when there is none, the operands
+ * are kept for a later compaction unless this is the last level.
+ */
+void removeDup(std::vector<ele> &eleArr, const mergeOperator &op, bool lastLevel) {
+    size_t cur = 0;
+    std::vector<std::string> pending;
+    for (size_t i = 0; i < eleArr.size();) {
+        size_t j = i + 1;
+        while (j < eleArr.size() && eleArr[j].key == eleArr[i].key)
+            ++j;
+        if (isMerge(eleArr[i].value)) {
+            pending.clear();
+            size_t b = i;
+            while (b < j && isMerge(eleArr[b].value))
+                pending.push_back(eleArr[b++].value);
+            if (b < j || lastLevel) { // 找到了基准值，或者更深处没有数据了
+                const std::string *base = (b < j && eleArr[b].value != DEL) ? &eleArr[b].value : nullptr;
+                eleArr[i].value         = mergeFold(op, eleArr[i].key, base, pending);
+            } else {
+                std::string combined = pending.back();
+                for (size_t p = pending.size() - 1; p-- > 0;)
+                    combined = mergeCombine(combined, pending[p]);
+                eleArr[i].value = combined;
+            }
         }
-        it = it2;
+        if (cur != i)
+            eleArr[cur] = std::move(eleArr[i]);
+        cur++;
+        i = j;
     }
+    eleArr.resize(cur);
 }
 
 void removeDel(std::vector<ele> &eleArr) {
@@ -329,10 +1010,39 @@ void removeDel(std::vector<ele> &eleArr) {
     }
 }
 
-std::vector<sstablehead>::iterator findMin(std::vector<sstablehead> &ssh) {
+// 删除被更新的范围删除覆盖的 key，eleArr 已按 key 排序且去重
+void removeCovered(std::vector<ele> &eleArr, std::vector<rangeEle> &rangeArr) {
+    if (rangeArr.empty())
+        return;
+    std::sort(rangeArr.begin(), rangeArr.end(), [](const rangeEle &a, const rangeEle &b) {
+        return a.start < b.start;
+    });
+    std::vector<rangeEle> active; // 起点不大于当前 key 的范围删除
+    size_t nxt = 0, cur = 0;
+    for (size_t i = 0; i < eleArr.size(); ++i) {
+        uint64_t key = eleArr[i].key;
+        while (nxt < rangeArr.size() && rangeArr[nxt].start <= key)
+            active.push_back(rangeArr[nxt++]);
+        active.erase(
+            std::remove_if(active.begin(), active.end(), [key](const rangeEle &r) { return r.end < key; }),
+            active.end()
+        );
+        bool covered = false;
+        for (const rangeEle &r : active)
+            covered = covered || r.covers(key, eleArr[i].time, eleArr[i].level);
+        if (covered)
+            continue;
+        if (cur != i)
+            eleArr[cur] = std::move(eleArr[i]);
+        cur++;
+    }
+    eleArr.resize(cur);
+}
+
+std::vector<tableHandle>::iterator findMin(std::vector<tableHandle> &ssh) {
     auto minSst = ssh.begin();
     for (auto it = ssh.begin(); it != ssh.end(); ++it) {
-        if (*it < *minSst) {
+        if (**it < **minSst) {
             minSst = it;
         }
     }
@@ -340,23 +1050,111 @@ std::vector<sstablehead>::iterator findMin(std::vector<sstablehead> &ssh) {
 }
 
 
-void KVStore::generateSST(const std::vector<ele> &eleArr, int level) {
-    sstable ss(level);
+// 把 ranges 落在 [lo, hi] 内的部分加入 ss，跨过 hi 的部分留给下一张表
+static void clipRanges(sstable &ss, const std::vector<rangeDel> &ranges, size_t &r, uint64_t lo, uint64_t hi) {
+    while (r < ranges.size() && ranges[r].start <= hi) {
+        ss.addRange(rangeDel(std::max(ranges[r].start, lo), std::min(ranges[r].end, hi)));
+        if (ranges[r].end > hi)
+            break;
+        ++r;
+    }
+}
+
+// 同一层的 sstable 连同范围删除在内互不相交，所以范围删除按表的边界切开
+void KVStore::generateSST(const std::vector<ele> &eleArr, const std::vector<rangeDel> &ranges, int level, bool sync) {
+    sstable ss(level, filterType, levelBitsPerKey(level));
+    size_t r    = 0; // 下一个还没有写完的范围删除
+    uint64_t lo = 0; // 当前 sstable 负责的区间下界
     for (ele it : eleArr) { 
         if (ss.checkSize(it.value, level)) {
-            ss.addNewSst(level);
+            clipRanges(ss, ranges, r, lo, it.key - 1);
+            ss.addNewSst(level, sync);
             addsstable(ss, level);
             ss.reset();
+            lo = it.key;
         }
         ss.insert(it.key, it.value);
     }
-    if (ss.getCnt()) {
-        ss.addNewSst(level);
+    clipRanges(ss, ranges, r, lo, INF);
+    if (!ss.empty()) {
+        ss.addNewSst(level, sync);
         addsstable(ss, level);
     }
 }
 
 
+/*
+ * 合并的重做记录，一轮一个：先写下输出层、开始时的时间戳和输入的文件，
+ * 输出全部落盘之后追加 commit，输入删完再删掉记录。
+ * 重启时没有 commit 就删掉输出层里比时间戳新的表（输入都还在），有 commit 就删掉剩下的输入。
+ * 崩溃在哪一步都不会丢数据，也不会同时留下输入和输出。
+ */
+static const std::string COMPACTION_LOG = "./data/compaction.log";
+
+static void writeCompactionLog(int level, uint64_t time, const std::vector<std::string> &inputs, bool sync) {
+    FILE *file = fopen(COMPACTION_LOG.data(), "w");
+    fprintf(file, "%d %llu\n", level, (unsigned long long)time);
+    for (const std::string &f : inputs)
+        fprintf(file, "%s\n", f.data());
+    fflush(file);
+    if (sync)
+        fsync(fileno(file));
+    fclose(file);
+    if (sync)
+        utils::syncDir("./data");
+}
+
+static void commitCompactionLog(bool sync) {
+    FILE *file = fopen(COMPACTION_LOG.data(), "a");
+    fputs("commit\n", file);
+    fflush(file);
+    if (sync)
+        fsync(fileno(file));
+    fclose(file);
+}
+
+/**
+ * Finish or roll back the compaction round a crash interrupted, before
+ * the tables are loaded. See COMPACTION_LOG.
+ */
+void KVStore::recoverCompaction(const std::string &dir) {
+    std::string path = dir + "/compaction.log";
+    std::ifstream in(path);
+    if (!in)
+        return;
+    int level;
+    unsigned long long time;
+    std::vector<std::string> inputs;
+    std::string line;
+    bool committed = false;
+    if (in >> level >> time) {
+        std::getline(in, line);
+        while (!committed && std::getline(in, line)) {
+            if (line == "commit")
+                committed = true;
+            else
+                inputs.push_back(line);
+        }
+        std::string out = dir + "/level-" + std::to_string(level);
+        if (committed) { // 输出已经完整，删掉剩下的输入，已经删过的会失败
+            for (const std::string &f : inputs)
+                utils::rmfile(f.data());
+            utils::syncDir((dir + "/level-" + std::to_string(level - 1)).data());
+        } else if (utils::dirExists(out)) { // 输出可能只写了一部分，输入都在，删掉输出
+            std::vector<std::string> files;
+            utils::scanDir(out, files);
+            for (const std::string &f : files) {
+                if (isdigit(f[0]) && std::stoull(f) > time) // 文件名以时间戳开头
+                    utils::rmfile((out + "/" + f).data());
+            }
+        }
+        utils::syncDir(out.data());
+    }
+    in.close();
+    utils::rmfile(path.data());
+    utils::syncDir(dir.data());
+}
+
 void KVStore::compaction() {
     for (int level = 0; level <= totalLevel; ++level) {
         if (sstableIndex[level].size() <= maxLimit(level)) {
@@ -364,6 +1162,8 @@ void KVStore::compaction() {
         }
         uint64_t minKey = INF, maxKey = -1;
         std::vector<ele> eleArr;
+        std::vector<rangeEle> rangeArr;
+        std::vector<std::string> inputs; // 这一轮的输入，输出落盘之后才删除文件
 
         if (level == totalLevel) {
             ++totalLevel;
@@ -373,41 +1173,50 @@ void KVStore::compaction() {
 
         if (level == 0) {
             for (auto it = sstableIndex[0].begin(); it != sstableIndex[0].end();) {
-                minKey = std::min(minKey, it->getMinV());
-                maxKey = std::max(maxKey, it->getMaxV());
+                minKey = std::min(minKey, (*it)->getMinV());
+                maxKey = std::max(maxKey, (*it)->getMaxV());
                 sstable ss;
-                ss.loadFile(it->getFilename().data());
+                ss.loadFile((*it)->getFilename().data());
                 for (int i = 0; i < ss.getCnt(); ++i) {
                     ele e(ss.getKey(i), ss.getData(i), ss.getTime(), 0);
                     eleArr.emplace_back(e);
                 }
-                it = delsstable(it->getFilename());
+                for (const rangeDel &r : ss.getRanges())
+                    rangeArr.emplace_back(r, ss.getTime(), 0);
+                inputs.push_back((*it)->getFilename());
+                it = delsstable((*it)->getFilename());
             }
         }
         else {
             for (int i = 0; i < sstableIndex[level].size() - maxLimit(level); ++i) {
                 auto it = findMin(sstableIndex[level]);
-                minKey = std::min(minKey, it->getMinV());
-                maxKey = std::max(maxKey, it->getMaxV());
+                minKey = std::min(minKey, (*it)->getMinV());
+                maxKey = std::max(maxKey, (*it)->getMaxV());
                 sstable ss;
-                ss.loadFile(it->getFilename().data());
+                ss.loadFile((*it)->getFilename().data());
                 for (int i = 0; i < ss.getCnt(); ++i) {
                     ele e(ss.getKey(i), ss.getData(i), ss.getTime(), level);
                     eleArr.emplace_back(e);
                 }
-                delsstable(it->getFilename());
+                for (const rangeDel &r : ss.getRanges())
+                    rangeArr.emplace_back(r, ss.getTime(), level);
+                inputs.push_back((*it)->getFilename());
+                delsstable((*it)->getFilename());
             }
         }
 
         for (auto it = sstableIndex[level+1].begin(); it != sstableIndex[level+1].end();) {
-            if (!(it->getMaxV() < minKey || it->getMinV() > maxKey)) {
+            if (!((*it)->getMaxV() < minKey || (*it)->getMinV() > maxKey)) {
                 sstable ss;
-                ss.loadFile(it->getFilename().data());
+                ss.loadFile((*it)->getFilename().data());
                 for(int i = 0; i < ss.getCnt(); ++i) {
                     ele e(ss.getKey(i), ss.getData(i), ss.getTime(), level+1);
                     eleArr.emplace_back(e);
                 }
-                it = delsstable(it->getFilename());
+                for (const rangeDel &r : ss.getRanges())
+                    rangeArr.emplace_back(r, ss.getTime(), level + 1);
+                inputs.push_back((*it)->getFilename());
+                it = delsstable((*it)->getFilename());
             }
             else {
                 ++it;
@@ -418,24 +1227,50 @@ void KVStore::compaction() {
         std::vector<ele> tmpArr(eleArr.size());
         MergeSort(eleArr, tmpArr, 0, eleArr.size() - 1);
         //printf("finish sort\n");
-        removeDup(eleArr);
+        removeCovered(eleArr, rangeArr); // 先去掉被覆盖的旧值，merge 才不会合并到它们上面
+        removeDup(eleArr, mergeOp, level + 1 == totalLevel);
         //printf("finish removeDup\n");
+        std::vector<rangeDel> ranges;
         if(level + 1 == totalLevel) {
-            removeDel(eleArr);
+            removeDel(eleArr); // 最后一层不需要任何删除标记
+        }
+        else {
+            for (const rangeEle &r : rangeArr)
+                mergeRange(ranges, rangeDel(r.start, r.end));
         }
         //printf("finish removeDel\n");
     
-        generateSST(eleArr, level + 1);
+        bool sync       = log->getMode() != SYNC_NONE; // 日志要同步时合并的结果也要落盘
+        std::string out = "./data/level-" + std::to_string(level + 1);
+        writeCompactionLog(level + 1, TIME, inputs, sync);
+        generateSST(eleArr, ranges, level + 1, sync);
         //printf("finish generateSST\n");
+        if (sync)
+            utils::syncDir(out.data());
+        commitCompactionLog(sync);
+        for (const std::string &f : inputs) {
+            if (utils::rmfile(f.data()) != 0) {
+                std::cout << "delete fail!" << std::endl;
+                std::cout << strerror(errno) << std::endl;
+            }
+        }
+        if (sync) {
+            utils::syncDir(("./data/level-" + std::to_string(level)).data());
+            utils::syncDir(out.data());
+        }
+        utils::rmfile(COMPACTION_LOG.data());
+        install(); // 这一轮的输入和输出一起换上
     }
 }
 
-std::vector<sstablehead>::iterator KVStore::delsstable(std::string filename) {
-    std::vector<sstablehead>::iterator it;
+std::vector<tableHandle>::iterator KVStore::delsstable(std::string filename) {
+    std::vector<tableHandle>::iterator it;
     for (int level = 0; level <= totalLevel; ++level) {
         int size = sstableIndex[level].size(), flag = 0;
         for (int i = 0; i < size; ++i) {
-            if (sstableIndex[level][i].getFilename() == filename) {
+            if (sstableIndex[level][i]->getFilename() == filename) {
+                if (tableCache.pin(filename) >= 0) // 已经装入的版本还引用它，读者随时可能来读
+                    obsolete.push_back(sstableIndex[level][i]);
                 it = sstableIndex[level].erase(sstableIndex[level].begin() + i);
                 flag = 1;
                 break;
@@ -444,54 +1279,358 @@ std::vector<sstablehead>::iterator KVStore::delsstable(std::string filename) {
         if (flag)
             break;
     }
-    int flag = utils::rmfile(filename.data());
-    if (flag != 0) {
-        std::cout << "delete fail!" << std::endl;
-        std::cout << strerror(errno) << std::endl;
-    }
+    tableCache.evict(filename);
     return it;
 }
 
-void KVStore::addsstable(sstable ss, int level) {
-    sstableIndex[level].push_back(ss.getHead());
+void KVStore::addsstable(const sstable &ss, int level) {
+    std::shared_ptr<sstablehead> head = ss.getHead();
+    head->setFileId(++fileSeq);
+    std::vector<tableHandle> &tables = sstableIndex[level];
+    if (!level) {
+        tables.push_back(head); // 0 层按时间，新表总在最后
+        return;
+    }
+    auto pos = std::upper_bound(tables.begin(), tables.end(), head->getMinV(),
+                                [](uint64_t key, const tableHandle &t) { return key < t->getMinV(); });
+    tables.insert(pos, head);
+}
+
+size_t KVStore::findTable(const std::vector<tableHandle> &tables, uint64_t key) {
+    return std::partition_point(tables.begin(), tables.end(), // 互不相交，maxV 也是有序的
+                                [key](const tableHandle &t) { return t->getMaxV() < key; }) -
+           tables.begin();
 }
 
-char strBuf[2097152];
+// 文件已经删除，fd 一直固定到最后一个引用它的快照或迭代器释放
+void KVStore::releaseObsolete() {
+    for (auto it = obsolete.begin(); it != obsolete.end();) {
+        if (it->use_count() > 1) {
+            ++it;
+            continue;
+        }
+        tableCache.unpin((*it)->getFilename());
+        it = obsolete.erase(it);
+    }
+}
 
 /**
- * @brief Fetches a substring from a file starting at a given offset.
+ * @brief Fetches a substring of a v1 sstable's data section.
  *
- * This function opens a file in binary read mode, seeks to the specified start offset,
- * reads a specified number of bytes into a buffer, and returns the buffer as a string.
+ * The data section is read in BLOCK_SIZE blocks aligned to the start of
+ * the file. Blocks come from the block cache when possible; a missing
+ * block is read with one pread through the table cache and cached.
  *
- * @param file The path to the file from which to read the substring.
+ * @param ssh The table to read from.
  * @param startOffset The offset in the file from which to start reading.
  * @param len The number of bytes to read from the file.
  * @return A string containing the read bytes.
  */
-std::string KVStore::fetchString(std::string file, int startOffset, uint32_t len) {
-    FILE *fp = fopen(file.data(), "rb");
-    if (fp == nullptr) {
-        std::cerr << "Error: Unable to open file " << file << std::endl;
-        return "";
+std::string KVStore::fetchString(const sstablehead &ssh, uint32_t startOffset, uint32_t len) {
+    std::string res;
+    res.reserve(len);
+    uint32_t end = startOffset + len;
+    for (uint32_t b = startOffset / BLOCK_SIZE * BLOCK_SIZE; b < end; b += BLOCK_SIZE) {
+        blockHandle block = readBlock(ssh, blockIndex(0, b, std::min<uint32_t>(BLOCK_SIZE, ssh.getDataEnd() - b)));
+        if (!block)
+            return "";
+        uint32_t from = std::max(startOffset, b) - b;
+        uint32_t to   = std::min<uint32_t>(end - b, block->length());
+        res.append(*block, from, to - from);
+    }
+    return res;
+}
+
+// 读入一个数据块：先查块缓存，没有命中时通过表缓存读文件
+blockHandle KVStore::readBlock(const sstablehead &ssh, const blockIndex &b) {
+    blockHandle block = blockCache.lookup(ssh.getFileId(), b.offset);
+    if (block)
+        return block;
+    std::string buf(b.size, '\0');
+    if (!tableCache.read(ssh.getFilename(), b.offset, b.size, &buf[0]))
+        return nullptr;
+    block = std::make_shared<const std::string>(std::move(buf));
+    blockCache.insert(ssh.getFileId(), b.offset, block);
+    return block;
+}
+
+/**
+ * Submit reads for the given data blocks of one table, ids ascending and
+ * distinct, and call ready(j, block) once block ids[j] is in memory:
+ * right away when it is in the block cache or the page cache, otherwise
+ * from io.wait(). Blocks missing from the cache that sit next to each
+ * other in the file go out as a single read and are split when it
+ * completes. Whatever ready refers to must stay in place until io.wait()
+ * returns; blocks whose read failed are passed to ready as null.
+ */
+void KVStore::readBlocksAsync(const sstablehead &ssh, const std::vector<int> &ids, asyncreader &io,
+                              const blockReady &ready) {
+    auto shared = std::make_shared<std::vector<blockIndex>>(ids.size()); // 块索引要解码，每块只解一次
+    std::vector<blockIndex> &where = *shared;
+    std::vector<blockHandle> blocks(ids.size());
+    for (size_t j = 0; j < ids.size(); ++j) {
+        where[j]  = ssh.getBlock(ids[j]);
+        blocks[j] = blockCache.lookup(ssh.getFileId(), where[j].offset);
+    }
+    for (size_t j = 0; j < ids.size();) {
+        if (blocks[j]) {
+            ready(j, blocks[j]);
+            j++;
+            continue;
+        }
+        size_t end   = j + 1;
+        uint32_t len = where[j].size;
+        // 紧接在后面的缺块并进同一次读
+        while (end < ids.size() && !blocks[end] && where[end].offset == where[j].offset + len)
+            len += where[end++].size;
+        int fd = tableCache.pin(ssh.getFilename());
+        if (fd < 0) {
+            for (; j < end; ++j)
+                ready(j, nullptr);
+            continue;
+        }
+        auto buf = std::make_shared<std::string>(len, '\0');
+        io.read(fd, where[j].offset, len, &(*buf)[0], [this, &ssh, ready, j, end, shared, buf](bool ok) {
+            tableCache.unpin(ssh.getFilename());
+            if (!ok) {
+                for (size_t k = j; k < end; ++k)
+                    ready(k, nullptr);
+                return;
+            }
+            const std::vector<blockIndex> &where = *shared;
+            for (uint32_t pos = 0, k = j; k < end; pos += where[k++].size) {
+                blockHandle block;
+                if (end - j == 1) // 只有一块，不用再复制
+                    block = std::make_shared<const std::string>(std::move(*buf));
+                else
+                    block = std::make_shared<const std::string>(*buf, pos, where[k].size);
+                blockCache.insert(ssh.getFileId(), where[k].offset, block);
+                ready(k, block);
+            }
+        });
+        j = end;
+    }
+}
+
+/**
+ * Find the blocks holding the batch's keys and search each one as soon as
+ * it is read. hit and vals are complete after io.wait(); old tables
+ * without blocks are searched right here.
+ */
+void KVStore::loadBatch(tableBatch &batch, asyncreader &io) {
+    const sstablehead &ssh = *batch.ssh;
+    batch.hit.assign(batch.keys.size(), 0);
+    batch.vals.resize(batch.keys.size());
+    if (ssh.getVersion() < 2) { // 老格式没有数据块
+        for (size_t i = 0; i < batch.keys.size(); ++i)
+            batch.hit[i] = searchTable(ssh, batch.keys[i], batch.vals[i]);
+        return;
+    }
+    batch.of.resize(batch.keys.size());
+    for (size_t i = 0; i < batch.keys.size(); ++i) {
+        batch.of[i] = ssh.findBlock(batch.keys[i]);
+        if (batch.of[i] != (int)ssh.getBlockCnt() && (batch.ids.empty() || batch.ids.back() != batch.of[i]))
+            batch.ids.push_back(batch.of[i]);
+    }
+    readBlocksAsync(ssh, batch.ids, io,
+                    [this, &batch](size_t j, const blockHandle &block) { searchBlock(batch, j, block); });
+}
+
+// 查 batch 中落在第 j 个要读的块里的 key
+void KVStore::searchBlock(tableBatch &batch, size_t j, const blockHandle &block) {
+    if (!block) { // 读失败，这张表里的结果不可信
+        batch.failed = true;
+        return;
+    }
+    auto range = std::equal_range(batch.of.begin(), batch.of.end(), batch.ids[j]); // of 不减
+    blockiter it(*block); // 同一个块里的 key 升序，共用一个迭代器
+    for (size_t i = range.first - batch.of.begin(); i < (size_t)(range.second - batch.of.begin()); ++i) {
+        it.seek(batch.keys[i]);
+        if (it.valid() && it.key() == batch.keys[i]) {
+            batch.vals[i] = it.value();
+            batch.hit[i]  = 1;
+        }
+    }
+}
+
+// 0 层的表都可能含有 key：先为每个过滤器发出预取，再逐个判断，几次 cache miss 互相重叠
+uint64_t KVStore::probeLevel0(const std::vector<tableHandle> &tables, uint64_t key, const keyHash &h) {
+    size_t n = std::min<size_t>(tables.size(), 64);
+    for (size_t i = 0; i < n; ++i) {
+        if (key >= tables[i]->getMinV() && key <= tables[i]->getMaxV())
+            tables[i]->prefetchFilter(h);
+    }
+    uint64_t maybe = 0;
+    for (size_t i = 0; i < n; ++i) {
+        if (key >= tables[i]->getMinV() && key <= tables[i]->getMaxV() && tables[i]->mayContain(h))
+            maybe |= 1ull << i;
+    }
+    return maybe;
+}
+
+// 在一张 sstable 中查找 key，找到时把 value（可能是删除标记）放进 res
+bool KVStore::searchTable(const sstablehead &ssh, uint64_t key, std::string &res) {
+    if (ssh.getVersion() < 2) {
+        uint32_t len;
+        int offset = ssh.searchOffset(key, len);
+        if (offset == -1)
+            return false;
+        res = fetchString(ssh, ssh.getDataStart() + offset, len);
+        return true;
+    }
+    int b = ssh.findBlock(key);
+    if (b == (int)ssh.getBlockCnt())
+        return false;
+    blockHandle block = readBlock(ssh, ssh.getBlock(b));
+    if (!block)
+        return false;
+    blockiter it(*block);
+    it.seek(key);
+    if (!it.valid() || it.key() != key)
+        return false;
+    res = it.value();
+    return true;
+}
+
+void KVStore::setBlockCacheCapacity(size_t capacity) {
+    blockCache.setCapacity(capacity);
+}
+
+void KVStore::setRowCacheCapacity(size_t capacity) {
+    rowCache.setCapacity(capacity);
+    if (!capacity) // 关掉期间的写入不会失效缓存，重新打开时不能留下旧值
+        rowCache.clear();
+}
+
+void KVStore::setRangeFilter(bool on) {
+    rangeFilterOn = on;
+}
+
+void KVStore::setReadahead(bool on) {
+    readaheadOn = on;
+}
+
+void KVStore::setFilterPolicy(filterPolicy policy) {
+    std::lock_guard<std::mutex> lock(writeLock); // flush 和 compaction 在写锁下读取它
+    filterType = policy;
+}
+
+void KVStore::setFilterBitsPerKey(double bits, bool perLevel) {
+    std::lock_guard<std::mutex> lock(writeLock);
+    filterBits     = bits;
+    filterPerLevel = perLevel;
+}
+
+/**
+ * Bits per key for filters of tables written to the given level.
+ *
+ * With perLevel on, the budget is split Monkey-style: a lookup pays the
+ * sum of the levels' false positive rates, so the rates are made
+ * proportional to level capacity. Level i holds 2^(i+1) tables, so each
+ * level up gets ln 2 / (ln 2)^2 = 1 / ln 2 more bits per key than the one
+ * below, and the deepest level gets whatever keeps the capacity-weighted
+ * average at filterBits.
+ */
+double KVStore::levelBitsPerKey(int level) const {
+    if (!filterPerLevel)
+        return filterBits;
+    int last       = std::max(totalLevel, level);
+    double step    = 1 / std::log(2.0);
+    double total   = 0;
+    double shallow = 0; // 各层比最深层多出的位数，按容量加权
+    for (int i = 0; i <= last; ++i) {
+        total += maxLimit(i);
+        shallow += maxLimit(i) * step * (last - i);
     }
-    fseek(fp, startOffset, SEEK_SET);
-    fread(strBuf, 1, len, fp);
-    fclose(fp);
-    return std::string(strBuf, len);
+    return std::max(1.0, filterBits - shallow / total + step * (last - level));
 }
 
-std::vector<std::pair<std::uint64_t, std::string>> KVStore::search_knn(std::string query, int k) {
+blockcache::stats KVStore::getBlockCacheStats() {
+    return blockCache.getStats();
+}
+
+rowcache::stats KVStore::getRowCacheStats() {
+    return rowCache.getStats();
+}
+
+size_t KVStore::getIndexBytes(uint64_t &keys) {
+    size_t bytes = 0;
+    keys         = 0;
+    std::shared_ptr<const tableset> view = viewOf(nullptr);
+    for (int level = 0; level <= view->top(); ++level) {
+        for (const tableHandle &it : view->levels[level]) {
+            bytes += it->indexBytes();
+            keys += it->getCnt();
+        }
+    }
+    return bytes;
+}
+
+// merge 过的 key 按合并后的值重新计算向量
+void KVStore::refreshStaleVec() {
+    std::lock_guard<std::mutex> lock(writeLock);
+    if (staleVec.empty())
+        return;
+    std::vector<vecele> &vecList = ownVecs();
+    for (uint64_t key : staleVec) {
+        std::string val = get(key);
+        auto it         = std::find_if(vecList.begin(), vecList.end(), [key](const vecele &v) { return v.key == key; });
+        if (!val.length()) {
+            if (it != vecList.end())
+                vecList.erase(it);
+            continue;
+        }
+        std::vector<float> vec = embedding(val)[0];
+        if (it != vecList.end())
+            it->vec = vec;
+        else
+            vecList.emplace_back(key, vec);
+    }
+    staleVec.clear();
+}
+
+std::vector<vecele> &KVStore::ownVecs() {
+    if (vecArray.use_count() > 1) // 快照还在读，写时复制
+        vecArray = std::make_shared<std::vector<vecele>>(*vecArray);
+    return *vecArray;
+}
+
+/**
+ * Find the k values most similar to query. With snap, the vectors and
+ * values are the ones the snapshot sees; keys merged before the snapshot
+ * was taken get their vectors recomputed from the snapshot's values
+ * without touching the live table.
+ */
+std::vector<std::pair<std::uint64_t, std::string>> KVStore::search_knn(std::string query, int k,
+                                                                      const Snapshot *snap) {
     std::vector<std::pair<std::uint64_t, std::string>> ans;
     std::vector<std::pair<std::uint64_t, float>> sim;
+    std::shared_ptr<const std::vector<vecele>> vecList;
+    std::vector<vecele> fresh; // 快照里 merge 过的 key 按快照的值重算的向量
+    if (snap) {
+        vecList = snap->vecs;
+        for (uint64_t key : snap->staleVec) {
+            std::string val = get(key, snap);
+            if (val.length())
+                fresh.emplace_back(key, embedding(val)[0]);
+        }
+    } else {
+        refreshStaleVec();
+        std::lock_guard<std::mutex> lock(writeLock); // 只取引用，之后的写入会先复制
+        vecList = vecArray;
+    }
     std::vector<std::vector<float>> query_vec = embedding(query);
     size_t n_embd = query_vec[0].size();
 
     //  遍历计算各个元素与query的相似度
-    for (auto it = vecArray.begin(); it != vecArray.end(); ++it) {  
+    for (auto it = vecList->begin(); it != vecList->end(); ++it) {  
+        if (snap && snap->staleVec.count(it->key))
+            continue; // 用 fresh 里重算的
         std::pair<std::uint64_t, float> p(it->key, common_embd_similarity_cos(it->vec.data(), query_vec[0].data(), n_embd));
         sim.emplace_back(p);
     }
+    for (const vecele &v : fresh)
+        sim.emplace_back(v.key, common_embd_similarity_cos(v.vec.data(), query_vec[0].data(), n_embd));
 
     //  找到相似度前k大的元素
     for (int i = 0; i < k; ++i) {   
@@ -507,7 +1646,7 @@ std::vector<std::pair<std::uint64_t, std::string>> KVStore::search_knn(std::stri
 
     //  从磁盘中读出k个元素的value
     for (auto it = ans.begin(); it != ans.end(); ++it) {
-        it->second = get(it->first);
+        it->second = get(it->first, snap);
     }
 
     return ans;
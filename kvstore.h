@@ -1,28 +1,132 @@
 #pragma once
 
+#include "asyncreader.h"
+#include "blockcache.h"
+#include "iterator.h"
 #include "kvstore_api.h"
+#include "merge.h"
+#include "rowcache.h"
 #include "skiplist.h"
+#include "snapshot.h"
 #include "sstable.h"
 #include "sstablehead.h"
+#include "tablecache.h"
+#include "tableiter.h"
+#include "tableset.h"
+#include "wal.h"
+#include "writebatch.h"
 
 #include "embedding.h"
 
+#include <atomic>
+#include <deque>
+#include <functional>
 #include <map>
+#include <memory>
+#include <mutex>
 #include <set>
+#include <string_view>
+
+const unsigned SCAN_PARTS_PER_THREAD = 4; // parallel_scan 每个线程分到的分段数，快的线程多做几段
+
+typedef std::function<void(uint64_t key, std::string_view value)> scanCallback; // value 只在回调期间有效
 
 class KVStore : public KVStoreAPI {
     // You can add your implementation here
+    friend class tableiter;
+    friend class Iterator;
+
 private:
-    skiplist *s = new skiplist(0.5); // memtable
+    std::shared_ptr<skiplist> s = std::make_shared<skiplist>(0.5); // memtable，flush 时换一个新的
     // std::vector<sstablehead> sstableIndex;  // sstable的表头缓存
 
-    std::vector<sstablehead> sstableIndex[15]; // the sshead for each level
+    std::vector<tableHandle> sstableIndex[15]; // the sshead for each level, level 0 ordered by time, others by key
+                                               // 只有写线程用，改完之后 install 成新的版本给读者
+    // 读者看到的版本
+    std::atomic<std::shared_ptr<const tableset>> current;
+    std::atomic<uint64_t> applying{0};         // 写 WriteBatch 或范围删除期间为奇数，multi_get 跨过它就重读
+    tablecache tableCache;                     // 打开的 sstable 文件，读 value 时复用
+    blockcache blockCache;                     // 最近读过的数据块
+    rowcache rowCache;                         // 最近 get 过的 key 的结果，默认关闭
+    uint64_t fileSeq = 0;                      // 分配给 sstable 的文件编号，不会重复使用
+    uint64_t lastSeq = 0;                      // 每个写入的条目分配一个递增的序号，快照记下创建时的序号
+
+    std::set<const Snapshot *> snapshots; // 还没有释放的快照
+    std::shared_ptr<skiplist> frozen;     // 最近一个快照复制的 memtable，之后没有写入时新快照直接共用
+    uint64_t frozenVersion = 0;           // 复制时 memtable 的版本
+    std::vector<tableHandle> obsolete;    // 已经换掉的表：文件已删除，fd 固定在表缓存里，直到没有版本引用它
 
     int totalLevel = -1; // 层数
 
-    std::vector<vecele> vecArray;   // 存储各个元素对应的向量信息，用于knn查找
+    std::shared_ptr<std::vector<vecele>> vecArray = std::make_shared<std::vector<vecele>>(); // 各个元素的向量，用于knn查找；快照共用时写入前先复制
+    std::set<uint64_t> staleVec;    // merge 过的 key，向量要在 knn 查找前按合并后的值重算
+
+    mergeOperator mergeOp;    // 读、compaction 时合并 merge 操作数
+
+    bool blindDelete = false; // del 不先读旧值，直接写删除标记
+
+    filterPolicy filterType = FILTER_BLOOM; // 新写的 sstable 使用的过滤器
+    double filterBits       = BITS_PER_KEY; // 所有层平均每个 key 的过滤器位数
+    bool filterPerLevel     = true;         // 按层分配位数：浅层多、深层少
+    bool rangeFilterOn      = true;         // scan 先查范围过滤器再读表
+    bool readaheadOn        = true;         // 迭代器顺序读数据时一次读入一大段
+
+    wal *log;             // 预写日志，保存还没有落盘的 memtable
+    std::mutex writeLock; // 串行化写路径（WAL 顺序与 memtable 顺序一致）
+
+    void flushMem();                                                       // memtable 转成 level-0 的 sstable
+    bool memFull(uint64_t key, const std::string &val);                    // 插入 val 后 memtable 是否超过 2MB
+    bool memOver(uint32_t bytes, uint64_t keys) const;                     // 这么大的 memtable 写成 sstable 是否超过 2MB
+    uint64_t writeMem(uint8_t type, uint64_t key, const std::string &val); // 写 WAL 并插入 memtable
+    std::string mergeMem(uint64_t key, const std::string &operand);        // merge 之后 memtable 中的值
+    void refreshStaleVec();
+    std::vector<vecele> &ownVecs(); // 要修改的向量表，快照还在共用时先复制一份
+    void releaseObsolete();         // 关闭不再被引用的旧表
+    void install();                 // 把 s 和 sstableIndex 装成新的当前版本
+    void beginApply();              // 之后对 memtable 的多处修改，读者要么全看到要么都看不到
+    void endApply();
+    // 收尾崩溃时没有做完的一轮合并
+    static void recoverCompaction(const std::string &dir);
+
+    std::shared_ptr<const tableset> viewOf(const Snapshot *snap) const; // snap 为空时取当前版本
+
+    blockHandle readBlock(const sstablehead &ssh, const blockIndex &b);
+    std::vector<uint64_t> splitRange(const tableset &view, uint64_t key1, uint64_t key2,
+                                     size_t parts);           // parallel_scan 的分段终点
+    std::string readKey(uint64_t key, const tableset &view); // 不经过行缓存的 get
+    bool searchTable(const sstablehead &ssh, uint64_t key, std::string &res); // 调用方先查过滤器
+    struct tableBatch { // multi_get 在一张表里要查的 key，块读到就查
+        const sstablehead *ssh;
+        size_t from, to;                // 表的 key 范围内、还没有结果的 key 在 todo 中的位置
+        std::vector<size_t> idx;        // 通过过滤器的 key 在排好序的 key 中的下标
+        std::vector<uint64_t> keys;     // 这些 key，升序
+        std::vector<int> of, ids;       // 每个 key 所在的块；要读的块，升序
+        std::vector<char> hit;          // wait 之后有效：key 在这张表里
+        std::vector<std::string> vals;  // 找到的值，可能是删除标记或 merge 串
+        bool failed;                    // wait 之后有效：有块没读出来
+
+        void reset(const sstablehead *table, size_t begin, size_t end) {
+            ssh    = table;
+            from   = begin;
+            to     = end;
+            failed = false;
+            idx.clear();
+            keys.clear();
+            ids.clear();
+        }
+    };
+    typedef std::function<void(size_t j, const blockHandle &block)> blockReady; // 第 j 个块可用了，读失败时为空
+    void readBlocksAsync(const sstablehead &ssh, const std::vector<int> &ids, asyncreader &io,
+                         const blockReady &ready); // 提交读，相邻的缺块合并成一次读
+    void loadBatch(tableBatch &batch, asyncreader &io);
+    void searchBlock(tableBatch &batch, size_t j, const blockHandle &block);
+    static uint64_t probeLevel0(const std::vector<tableHandle> &tables, uint64_t key,
+                                const keyHash &h); // 一次探测 0 层前 64 张表的过滤器
+    static size_t findTable(const std::vector<tableHandle> &tables, uint64_t key); // 非 0 层第一张 maxV >= key 的表，没有返回表数
+    double levelBitsPerKey(int level) const;         // 写到 level 层的 sstable 每个 key 的过滤器位数
+
 public:
-    KVStore(const std::string &dir);
+    KVStore(const std::string &dir, mergeOperator op = appendOperator); // WAL 重放 merge 时需要 op
 
     ~KVStore();
 
@@ -30,19 +134,70 @@ public:
 
     std::string get(uint64_t key) override;
 
+    std::string get(uint64_t key, const Snapshot *snap); // snap 为空时同 get(key)；通过快照读不经过行缓存
+
+    std::vector<std::string> multi_get(const std::vector<uint64_t> &keys); // 按 keys 的顺序返回，没找到为空串
+
     bool del(uint64_t key) override;
 
+    void del_blind(uint64_t key); // 不读旧值，直接写删除标记
+
+    void del_range(uint64_t key1, uint64_t key2); // 删除 [key1, key2] 内所有的 key，只写一个范围删除标记
+
+    void setBlindDelete(bool blind); // 打开后 del 等价于 del_blind，总是返回 true
+
+    void merge(uint64_t key, const std::string &operand); // 不读旧值，记录操作数，读的时候再合并
+
+    void setMergeOperator(mergeOperator op);
+
+    bool write(const WriteBatch &batch); // 原子地应用一组 put/del，整批放不进一张 sstable 时什么都不写，返回 false
+
     void reset() override;
 
+    void setSyncMode(SYNCMODE mode); // WAL 的落盘方式
+
     void scan(uint64_t key1, uint64_t key2, std::list<std::pair<uint64_t, std::string>> &list) override;
 
+    void scan(uint64_t key1, uint64_t key2, std::list<std::pair<uint64_t, std::string>> &list, size_t limit,
+              const Snapshot *snap = nullptr); // 最多 limit 行
+
+    // 只遍历 [lower, upper]；给了 snap 时读快照，迭代器要在快照释放之前销毁
+    std::unique_ptr<Iterator> new_iterator(uint64_t lower = 0, uint64_t upper = INF, const Snapshot *snap = nullptr);
+
+    const Snapshot *get_snapshot(); // 当前状态的只读视图，用完要 release_snapshot
+
+    void release_snapshot(const Snapshot *snap);
+
+    // 多线程扫描 [key1, key2] 在调用时的快照：ordered 时在调用线程上按 key 顺序回调，否则在工作线程上并发回调
+    void parallel_scan(uint64_t key1, uint64_t key2, const scanCallback &callback, unsigned threads = 0,
+                       bool ordered = true);
+
     void compaction();
-    void generateSST(const std::vector<ele> &eleArr, int level);
+    void generateSST(const std::vector<ele> &eleArr, const std::vector<rangeDel> &ranges, int level, bool sync);
+
+    std::vector<tableHandle>::iterator delsstable(std::string filename);  // 从缓存中删除filename.sst，返回新的有效迭代器；文件由 compaction 在输出落盘后删除
+    void addsstable(const sstable &ss, int level); // 将ss加入缓存
+
+    std::string fetchString(const sstablehead &ssh, uint32_t startOffset, uint32_t len);
+
+    void setBlockCacheCapacity(size_t capacity); // 字节数，0 表示不缓存
+
+    void setRowCacheCapacity(size_t capacity); // 字节数，0 表示不缓存
+
+    void setFilterPolicy(filterPolicy policy); // 只影响之后 flush 和 compaction 写出的 sstable
+
+    void setFilterBitsPerKey(double bits, bool perLevel = true); // 过滤器的内存预算，同样只影响新的 sstable
+
+    void setRangeFilter(bool on); // 关掉后 scan 只按 minV/maxV 跳过 sstable，用于对比
+
+    void setReadahead(bool on); // 关掉后 scan 逐块读取，用于对比
+
+    blockcache::stats getBlockCacheStats();
 
-    std::vector<sstablehead>::iterator delsstable(std::string filename);  // 从缓存中删除filename.sst， 并物理删除，返回新的有效迭代器
-    void addsstable(sstable ss, int level); // 将ss加入缓存
+    rowcache::stats getRowCacheStats();
 
-    std::string fetchString(std::string file, int startOffset, uint32_t len);
+    size_t getIndexBytes(uint64_t &keys); // 所有 sstable 索引占用的内存，keys 返回 sstable 中的 key 数
 
-    std::vector<std::pair<std::uint64_t, std::string>> search_knn(std::string query, int k);
+    std::vector<std::pair<std::uint64_t, std::string>> search_knn(std::string query, int k,
+                                                                  const Snapshot *snap = nullptr);
 };
@@ -0,0 +1,53 @@
+#include "merge.h"
+
+std::string appendOperator(uint64_t /*key*/, const std::string *existing, const std::string &operand) {
+    return existing ? *existing + operand : operand;
+}
+
+bool isMerge(std::string_view val) {
+    return val.substr(0, MERGE.length()) == MERGE;
+}
+
+std::string mergeAppend(const std::string &val, const std::string &operand) {
+    std::string res = val.empty() ? MERGE : val;
+    res += std::to_string(operand.length()) + ":" + operand;
+    return res;
+}
+
+std::string mergeCombine(const std::string &older, const std::string &newer) {
+    return older + newer.substr(MERGE.length());
+}
+
+void mergeOperands(const std::string &val, std::vector<std::string> &operands) {
+    size_t pos = MERGE.length();
+    while (pos < val.length()) {
+        size_t colon = val.find(':', pos);
+        if (colon == std::string::npos)
+            break;
+        size_t len = std::stoull(val.substr(pos, colon - pos));
+        operands.push_back(val.substr(colon + 1, len));
+        pos = colon + 1 + len;
+    }
+}
+
+std::string mergeFold(
+    const mergeOperator &op,
+    uint64_t key,
+    const std::string *base,
+    const std::vector<std::string> &pending
+) {
+    std::string res;
+    bool exists = base != nullptr;
+    if (exists)
+        res = *base;
+    std::vector<std::string> operands;
+    for (auto it = pending.rbegin(); it != pending.rend(); ++it) { // 从旧到新
+        operands.clear();
+        mergeOperands(*it, operands);
+        for (const std::string &operand : operands) {
+            res    = op(key, exists ? &res : nullptr, operand);
+            exists = true;
+        }
+    }
+    return res;
+}
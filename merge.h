@@ -0,0 +1,38 @@
+#pragma once
+
+#ifndef LSM_KV_MERGE_H
+#define LSM_KV_MERGE_H
+
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/*
+ * merge 操作数和 DEL 一样以特殊的 value 存在 memtable 和 sstable 中：
+ * MERGE 前缀后面是若干个 "长度:操作数"，按写入顺序从旧到新排列。
+ * 读的时候向更旧的数据找到基准值，再依次应用这些操作数。
+ */
+static const std::string MERGE = "~MERGE~";
+
+// existing 为 nullptr 表示 key 不存在（或已被删除），返回合并后的新值
+typedef std::function<std::string(uint64_t key, const std::string *existing, const std::string &operand)>
+    mergeOperator;
+
+std::string appendOperator(uint64_t key, const std::string *existing, const std::string &operand); // 默认：追加
+
+bool isMerge(std::string_view val);
+std::string mergeAppend(const std::string &val, const std::string &operand); // val 为空时新建一个 merge 串
+std::string mergeCombine(const std::string &older, const std::string &newer);
+void mergeOperands(const std::string &val, std::vector<std::string> &operands);
+
+// pending 为从新到旧的 merge 串，依次作用在 base 上
+std::string mergeFold(
+    const mergeOperator &op,
+    uint64_t key,
+    const std::string *base,
+    const std::vector<std::string> &pending
+);
+
+#endif // LSM_KV_MERGE_H
@@ -0,0 +1,129 @@
+#include "packedindex.h"
+
+#include "block.h"
+
+#include <algorithm>
+
+void packedindex::push(uint64_t key, uint32_t offset) {
+    if (!eytz.empty()) {
+        eytz.clear();
+        order.clear();
+    }
+    if (n % SKIP_STRIDE == 0)
+        skips.push_back(skip{lastKey, lastOffset, (uint32_t)rep.size()});
+    putVarint(rep, key - lastKey);
+    putVarint(rep, offset - lastOffset);
+    lastKey    = key;
+    lastOffset = offset;
+    n++;
+}
+
+bool packedindex::load(const std::string &encoded, uint32_t cnt) {
+    clear();
+    const char *p = encoded.data(), *limit = p + encoded.size();
+    for (uint32_t i = 0; i < cnt; ++i) {
+        uint64_t keyDelta, lenDelta;
+        p = getVarint(p, limit, keyDelta);
+        if (p)
+            p = getVarint(p, limit, lenDelta);
+        if (!p)
+            return false;
+        push(lastKey + keyDelta, lastOffset + lenDelta);
+    }
+    finish();
+    return true;
+}
+
+uint32_t packedindex::fill(const std::vector<uint64_t> &firsts, uint32_t i, uint32_t k) {
+    if (k >= eytz.size())
+        return i;
+    i        = fill(firsts, i, 2 * k);
+    eytz[k]  = firsts[i];
+    order[k] = i++;
+    return fill(firsts, i, 2 * k + 1);
+}
+
+void packedindex::finish() {
+    std::vector<uint64_t> firsts(skips.size());
+    for (uint32_t s = 0; s < skips.size(); ++s)
+        firsts[s] = firstKey(s);
+    eytz.assign(skips.size() + 1, 0);
+    order.assign(skips.size() + 1, 0);
+    fill(firsts, 0, 1);
+}
+
+void packedindex::clear() {
+    rep.clear();
+    skips.clear();
+    eytz.clear();
+    order.clear();
+    n          = 0;
+    lastKey    = 0;
+    lastOffset = base;
+}
+
+uint64_t packedindex::firstKey(uint32_t s) const {
+    uint64_t delta = 0;
+    getVarint(rep.data() + skips[s].pos, rep.data() + rep.size(), delta);
+    return skips[s].key + delta;
+}
+
+Index packedindex::at(int p, uint32_t *start) const {
+    const skip &s = skips[p / SKIP_STRIDE];
+    const char *q = rep.data() + s.pos, *limit = rep.data() + rep.size();
+    Index cur(s.key, s.offset);
+    uint32_t prev = s.offset;
+    for (int i = p / SKIP_STRIDE * SKIP_STRIDE; i <= p; ++i) {
+        uint64_t keyDelta, lenDelta;
+        q = getVarint(q, limit, keyDelta);
+        q = getVarint(q, limit, lenDelta);
+        prev = cur.offset;
+        cur.key += keyDelta;
+        cur.offset += lenDelta;
+    }
+    if (start)
+        *start = prev;
+    return cur;
+}
+
+uint32_t packedindex::findGroup(uint64_t key) const {
+    uint32_t m = skips.size();
+    if (eytz.size() == m + 1 && m) {
+        const uint64_t *t = eytz.data();
+        uint32_t k        = 1;
+        while (k <= m) {
+            __builtin_prefetch(t + std::min(8 * k, m)); // 往下第三层的 8 个节点在同一条 cache line 上
+            k = 2 * k + (t[k] < key);
+        }
+        k >>= __builtin_ffs(~k); // 去掉最后一串右转，回到最后一次左转的节点
+        return k ? order[k] : m;
+    }
+    uint32_t lo = 0, hi = m; // 没有 finish()，在编码上二分
+    while (lo < hi) {
+        uint32_t mid = (lo + hi) / 2;
+        if (firstKey(mid) < key)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+int packedindex::lowerBound(uint64_t key) const {
+    uint32_t lo = findGroup(key); // 第一个首项 >= key 的跳跃点
+    if (lo == 0)
+        return 0;
+    const skip &s = skips[lo - 1]; // 答案在上一组里，或者就是第 lo 组的首项
+    const char *q = rep.data() + s.pos, *limit = rep.data() + rep.size();
+    uint64_t cur = s.key;
+    uint32_t i   = (lo - 1) * SKIP_STRIDE;
+    for (; i < n && i < lo * SKIP_STRIDE; ++i) {
+        uint64_t keyDelta, lenDelta;
+        q = getVarint(q, limit, keyDelta);
+        q = getVarint(q, limit, lenDelta);
+        cur += keyDelta;
+        if (cur >= key)
+            return i;
+    }
+    return i;
+}
@@ -8,6 +8,15 @@
 #include <random>
 #include <vector>
 #include <algorithm>
+#include <thread>
+#include <cstdio>
+#include <cmath>
+#include <cstdlib>
+#include <atomic>
+#include <new>
+#include <fcntl.h>
+#include <unistd.h>
+#include <filesystem>
 
 #include "kvstore.h"
 
@@ -16,6 +25,69 @@ using namespace std::chrono;
 
 const uint64_t TEST_MAX = 1024 * 32; 
 const uint64_t KEY_RANGE = 1024 * 36;
+const uint64_t WAL_TEST_MAX = 1024 * 4;
+const int WAL_THREADS = 8;
+const uint64_t ZIPF_GETS = 1024 * 64;
+const uint64_t SMALL_VALUE_MAX = 1024 * 256;
+const double ZIPF_THETA = 0.99;
+const uint64_t INDEX_KEYS = 100000;
+const uint64_t INDEX_LOOKUPS = 1024 * 1024 * 4;
+const uint64_t FILTER_PROBES = 1024 * 1024 * 4;
+const uint64_t STATIC_FILTER_KEYS = 1024 * 1024;
+const uint64_t SPARSE_KEYS = 1024 * 256;
+const uint64_t SHORT_SCANS = 1024 * 16;
+const uint64_t SHORT_SCAN_WIDTH = 64;
+const uint64_t ROW_CACHE_KEYS = 1024 * 256;
+const size_t ROW_CACHE_TEST_CAPACITY = 64 * 1024 * 1024;
+const uint64_t MULTI_GET_KEYS = 1024 * 256;
+const uint64_t MULTI_GET_BATCH = 100;
+const uint64_t MULTI_GET_BATCHES = 1024;
+const uint64_t ASYNC_FILE_SIZE = 256ull * 1024 * 1024;
+const uint64_t ASYNC_READS = 1024 * 8;
+const uint64_t ITER_KEYS = 1024 * 64;
+const uint64_t ITER_SCANS = 64;
+const uint64_t ITER_ROWS = 100;
+const uint64_t LONG_SCAN_KEYS = 1024 * 128;
+const uint32_t LONG_SCAN_VALUE = 1024;
+const uint64_t PARALLEL_SCAN_KEYS = 1024 * 256;
+const uint64_t SNAPSHOT_KEYS = 1024 * 64;
+const uint64_t SNAPSHOT_TAKES = 1024;
+const uint64_t SNAPSHOT_GETS = 1024 * 128;
+const uint64_t CONCURRENT_KEYS = 1024 * 64;
+const uint64_t CONCURRENT_GETS = 1024 * 256;
+
+// 统计堆分配次数，用来衡量读路径上每次 get 的分配开销。
+// 数组和对齐的形式也一起替换，全部从 countedAlloc 分配、countedFree 释放
+static atomic<uint64_t> allocCount(0);
+
+static void* countedAlloc(size_t size, size_t align = 0) {
+    allocCount.fetch_add(1, memory_order_relaxed);
+    size = size ? size : 1;
+    void* p = align ? aligned_alloc(align, (size + align - 1) / align * align) : malloc(size);
+    if (!p) {
+        throw bad_alloc();
+    }
+    return p;
+}
+
+// 不内联：否则编译器看到 operator new 的结果被 free，报 -Wmismatched-new-delete
+__attribute__((noinline)) static void countedFree(void* p) noexcept {
+    free(p);
+}
+
+void* operator new(size_t size) { return countedAlloc(size); }
+void* operator new[](size_t size) { return countedAlloc(size); }
+void* operator new(size_t size, align_val_t align) { return countedAlloc(size, (size_t)align); }
+void* operator new[](size_t size, align_val_t align) { return countedAlloc(size, (size_t)align); }
+
+void operator delete(void* p) noexcept { countedFree(p); }
+void operator delete[](void* p) noexcept { countedFree(p); }
+void operator delete(void* p, size_t) noexcept { countedFree(p); }
+void operator delete[](void* p, size_t) noexcept { countedFree(p); }
+void operator delete(void* p, align_val_t) noexcept { countedFree(p); }
+void operator delete[](void* p, align_val_t) noexcept { countedFree(p); }
+void operator delete(void* p, size_t, align_val_t) noexcept { countedFree(p); }
+void operator delete[](void* p, size_t, align_val_t) noexcept { countedFree(p); }
 
 std::random_device rd;
 std::mt19937_64 gen(rd());
@@ -106,6 +178,654 @@ void test_get(KVStore& store, const vector<uint64_t>& keys) {
     printResult("GET", keys.size(), duration, found, keys.size());
 }
 
+void test_get_missing(KVStore& store, const vector<uint64_t>& keys) {
+    printHeader("GET PERFORMANCE (MISSING KEYS)");
+    
+    vector<bool> present(KEY_RANGE + 1, false);
+    for (const auto& key : keys) {
+        present[key] = true;
+    }
+    vector<uint64_t> missing; // 落在各表的 key 范围内，只能靠过滤器排除
+    for (uint64_t key = 1; key <= KEY_RANGE; key++) {
+        if (!present[key]) {
+            missing.push_back(key);
+        }
+    }
+    
+    auto start = high_resolution_clock::now();
+    
+    uint64_t found = 0;
+    for (int round = 0; round < 8; round++) {
+        for (const auto& key : missing) {
+            found += !store.get(key).empty();
+        }
+    }
+    
+    auto end = high_resolution_clock::now();
+    
+    printResult("GET MISSING", missing.size() * 8, duration_cast<milliseconds>(end - start), found, missing.size() * 8);
+}
+
+void test_get_allocs(KVStore& store) {
+    printHeader("GET ALLOCATIONS");
+    
+    // every key in the range: present keys are hits, the rest are misses
+    uint64_t hits = 0, misses = 0, hitAllocs = 0, missAllocs = 0;
+    for (uint64_t key = 1; key <= KEY_RANGE; key++) {
+        uint64_t before = allocCount.load(memory_order_relaxed);
+        string value = store.get(key);
+        uint64_t allocs = allocCount.load(memory_order_relaxed) - before;
+        if (value.empty()) {
+            misses++;
+            missAllocs += allocs;
+        } else {
+            hits++;
+            hitAllocs += allocs;
+        }
+    }
+    
+    cout << "  " << left << setw(15) << "Hit" << ": " << right << setw(9) << hits << " gets, "
+         << fixed << setprecision(2) << (hits ? (double)hitAllocs / hits : 0.0) << " allocs/get" << endl;
+    cout << "  " << left << setw(15) << "Miss" << ": " << right << setw(9) << misses << " gets, "
+         << fixed << setprecision(2) << (misses ? (double)missAllocs / misses : 0.0) << " allocs/get" << endl
+         << endl;
+}
+
+// zipf 分布的下标：排名越靠前被访问得越多
+vector<uint64_t> zipf_indexes(uint64_t n, uint64_t count) {
+    vector<double> cdf(n);
+    double sum = 0;
+    for (uint64_t i = 0; i < n; i++) {
+        sum += 1.0 / pow((double)(i + 1), ZIPF_THETA);
+        cdf[i] = sum;
+    }
+    uniform_real_distribution<double> dis(0, sum);
+    vector<uint64_t> res(count);
+    for (uint64_t i = 0; i < count; i++) {
+        res[i] = lower_bound(cdf.begin(), cdf.end(), dis(gen)) - cdf.begin();
+    }
+    return res;
+}
+
+void test_zipf_get(KVStore& store, const vector<uint64_t>& keys) {
+    printHeader("ZIPFIAN GET WITH BLOCK CACHE");
+    
+    vector<uint64_t> indexes = zipf_indexes(keys.size(), ZIPF_GETS);
+    
+    for (size_t capacity : {(size_t)0, BLOCK_CACHE_CAPACITY}) {
+        store.setBlockCacheCapacity(capacity);
+        blockcache::stats before = store.getBlockCacheStats();
+        
+        auto start = high_resolution_clock::now();
+        
+        for (const auto& i : indexes) {
+            store.get(keys[i]);
+        }
+        
+        auto end = high_resolution_clock::now();
+        blockcache::stats after = store.getBlockCacheStats();
+        uint64_t hits = after.hits - before.hits;
+        uint64_t lookups = hits + after.misses - before.misses;
+        
+        printResult(capacity ? "CACHE 64MB" : "NO CACHE", ZIPF_GETS, duration_cast<milliseconds>(end - start));
+        cout << "  " << left << setw(15) << "Block Hit Rate" << ": " << fixed << setprecision(1) << right << setw(9)
+             << (lookups ? (double)hits / lookups * 100 : 0.0) << "% (" << hits << "/" << lookups << ")" << endl
+             << endl;
+    }
+}
+
+void test_row_cache(KVStore& store) {
+    printHeader("ZIPFIAN GET WITH ROW CACHE (64-BYTE VALUES)");
+    
+    vector<uint64_t> keys(ROW_CACHE_KEYS);
+    WriteBatch batch; // 小 value，读的开销主要在查找而不是复制
+    for (auto& key : keys) {
+        key = gen() % (1ull << 40);
+        batch.put(key, generate_value(64));
+        if (batch.count() == 1024) {
+            store.write(batch);
+            batch.clear();
+        }
+    }
+    store.write(batch);
+    
+    vector<uint64_t> indexes = zipf_indexes(keys.size(), ZIPF_GETS);
+    
+    for (size_t capacity : {(size_t)0, ROW_CACHE_TEST_CAPACITY}) {
+        store.setRowCacheCapacity(capacity);
+        for (const auto& i : indexes) { // 预热，两种配置都读一遍，块缓存里的状态相同
+            store.get(keys[i]);
+        }
+        rowcache::stats before = store.getRowCacheStats();
+        
+        auto start = high_resolution_clock::now();
+        
+        for (const auto& i : indexes) {
+            store.get(keys[i]);
+        }
+        
+        auto end = high_resolution_clock::now();
+        rowcache::stats after = store.getRowCacheStats();
+        uint64_t hits = after.hits - before.hits;
+        uint64_t lookups = hits + after.misses - before.misses;
+        
+        printResult(capacity ? "ROW CACHE 64MB" : "BLOCK CACHE", ZIPF_GETS, duration_cast<milliseconds>(end - start));
+        cout << "  " << left << setw(15) << "Avg Get" << ": " << fixed << setprecision(1) << right << setw(9)
+             << (double)duration_cast<nanoseconds>(end - start).count() / ZIPF_GETS << " ns" << endl;
+        cout << "  " << left << setw(15) << "Row Hit Rate" << ": " << fixed << setprecision(1) << right << setw(9)
+             << (lookups ? (double)hits / lookups * 100 : 0.0) << "% (" << hits << "/" << lookups << ")" << endl;
+        cout << "  " << left << setw(15) << "Row Cache" << ": " << right << setw(9) << after.usage << " bytes"
+             << endl << endl;
+    }
+    store.setRowCacheCapacity(0);
+}
+
+void test_multi_get(KVStore& store) {
+    printHeader("MULTI_GET VS GET LOOP (100 KEYS, NO BLOCK CACHE)");
+    
+    WriteBatch batch;
+    for (uint64_t i = 0; i < MULTI_GET_KEYS; i++) {
+        batch.put(i * 16, generate_value(64));
+        if (batch.count() == 1024) {
+            store.write(batch);
+            batch.clear();
+        }
+    }
+    store.write(batch);
+    store.setBlockCacheCapacity(0); // 每次都读文件，看合并读的效果
+    
+    for (bool clustered : {false, true}) {
+        vector<vector<uint64_t>> batches(MULTI_GET_BATCHES);
+        for (auto& keys : batches) {
+            uint64_t start = gen() % (MULTI_GET_KEYS - MULTI_GET_BATCH);
+            for (uint64_t j = 0; j < MULTI_GET_BATCH; j++) { // 聚集: 一段连续的 key；随机: 整个键空间
+                keys.push_back(clustered ? (start + j) * 16 : gen() % MULTI_GET_KEYS * 16);
+            }
+        }
+        
+        for (const auto& keys : batches) { // 预热，让两种方式读到的文件都在页缓存里
+            store.multi_get(keys);
+        }
+        
+        auto start = high_resolution_clock::now();
+        for (const auto& keys : batches) {
+            for (uint64_t key : keys) {
+                store.get(key);
+            }
+        }
+        auto mid = high_resolution_clock::now();
+        for (const auto& keys : batches) {
+            store.multi_get(keys);
+        }
+        auto end = high_resolution_clock::now();
+        
+        double single = (double)duration_cast<nanoseconds>(mid - start).count() / (MULTI_GET_BATCHES * MULTI_GET_BATCH);
+        double loop = (double)duration_cast<nanoseconds>(mid - start).count() / MULTI_GET_BATCHES / 1000;
+        double multi = (double)duration_cast<nanoseconds>(end - mid).count() / MULTI_GET_BATCHES / 1000;
+        
+        cout << "  " << (clustered ? "Clustered keys" : "Random keys") << endl;
+        cout << "  " << left << setw(15) << "One get" << ": " << fixed << setprecision(1) << right << setw(9)
+             << single / 1000 << " us" << endl;
+        cout << "  " << left << setw(15) << "GET LOOP" << ": " << fixed << setprecision(1) << right << setw(9)
+             << loop << " us/batch" << endl;
+        cout << "  " << left << setw(15) << "MULTI_GET" << ": " << fixed << setprecision(1) << right << setw(9)
+             << multi << " us/batch (" << setprecision(1) << multi * 1000 / single << "x one get)" << endl
+             << endl;
+    }
+    store.setBlockCacheCapacity(BLOCK_CACHE_CAPACITY);
+}
+
+void test_async_read() {
+    printHeader("ASYNC READ IOPS BY QUEUE DEPTH (4KB, COLD PAGE CACHE)");
+    
+    string path = "./data/async_read_test";
+    int fd = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        cerr << "Error: cannot create " << path << endl;
+        return;
+    }
+    string chunk(1024 * 1024, 'a');
+    for (uint64_t off = 0; off < ASYNC_FILE_SIZE; off += chunk.size()) {
+        if (pwrite(fd, chunk.data(), chunk.size(), off) != (ssize_t)chunk.size()) {
+            cerr << "Error: cannot write " << path << endl;
+            close(fd);
+            return;
+        }
+    }
+    fsync(fd);
+    
+    for (unsigned depth : {1, 2, 4, 8, 16, 32, 64}) {
+        asyncreader io(depth);
+        posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED); // 每轮都从设备读
+        vector<char> bufs(depth * 4096);
+        uint64_t issued = 0, failed = 0;
+        function<void(unsigned)> issue = [&](unsigned slot) { // 读完一个就在同一个槽位发下一个
+            uint64_t offset = gen() % (ASYNC_FILE_SIZE / 4096) * 4096;
+            issued++;
+            io.read(fd, offset, 4096, &bufs[slot * 4096], [&, slot](bool ok) {
+                failed += !ok;
+                if (issued < ASYNC_READS) {
+                    issue(slot);
+                }
+            });
+        };
+        
+        auto start = high_resolution_clock::now();
+        for (unsigned slot = 0; slot < depth; slot++) {
+            issue(slot);
+        }
+        io.wait();
+        auto end = high_resolution_clock::now();
+        
+        double seconds = duration_cast<microseconds>(end - start).count() / 1e6;
+        cout << "  " << left << setw(15) << ("QD " + to_string(depth)) << ": " << fixed << setprecision(0) << right
+             << setw(9) << ASYNC_READS / seconds << " IOPS" << (io.usingRing() ? "" : " (pread fallback)")
+             << (failed ? " " + to_string(failed) + " failed" : "") << endl;
+    }
+    cout << endl;
+    close(fd);
+    unlink(path.c_str());
+}
+
+void test_index_memory(KVStore& store) {
+    printHeader("SSTABLE INDEX MEMORY (8-BYTE VALUES)");
+    
+    WriteBatch batch; // 一次 embedding 调用处理整批 value
+    for (uint64_t i = 0; i < SMALL_VALUE_MAX; i++) {
+        batch.put(i, generate_value(8));
+        if (batch.count() == 1024) {
+            store.write(batch);
+            batch.clear();
+        }
+    }
+    store.write(batch);
+    
+    uint64_t keys = 0;
+    size_t bytes = store.getIndexBytes(keys);
+    size_t perKey = keys * sizeof(Index); // v1 每个 key 一项
+    
+    cout << "  " << left << setw(15) << "Keys on disk" << ": " << right << setw(9) << keys << endl;
+    cout << "  " << left << setw(15) << "Block index" << ": " << right << setw(9) << bytes << " bytes" << endl;
+    cout << "  " << left << setw(15) << "Per-key index" << ": " << right << setw(9) << perKey << " bytes" << endl;
+    cout << "  " << left << setw(15) << "Reduction" << ": " << right << setw(9) << fixed << setprecision(1)
+         << (bytes ? (double)perKey / bytes : 0.0) << "x" << endl
+         << endl;
+}
+
+void test_index_search() {
+    printHeader("IN-MEMORY INDEX SEARCH (" + to_string(INDEX_KEYS) + " KEYS)");
+    
+    vector<Index> plain; // 原来的 AoS 数组 + std::lower_bound
+    packedindex binary, eytzinger; // binary 不 finish()，在编码上二分
+    uint64_t key = 0;
+    uint32_t offset = 0;
+    for (uint64_t i = 0; i < INDEX_KEYS; i++) {
+        key += 1 + gen() % 64;
+        offset += 8 + gen() % 64;
+        plain.emplace_back(key, offset);
+        binary.push(key, offset);
+        eytzinger.push(key, offset);
+    }
+    eytzinger.finish();
+    
+    vector<uint64_t> probes(INDEX_LOOKUPS);
+    for (auto& p : probes) {
+        p = gen() % (key + 1);
+    }
+    
+    uint64_t sum = 0; // 防止查找被优化掉
+    auto start = high_resolution_clock::now();
+    for (const auto& p : probes) {
+        sum += lower_bound(plain.begin(), plain.end(), Index(p, 0)) - plain.begin();
+    }
+    auto end = high_resolution_clock::now();
+    printResult("STD LOWER_BOUND", INDEX_LOOKUPS, duration_cast<milliseconds>(end - start));
+    
+    uint64_t check = sum;
+    for (packedindex* idx : {&binary, &eytzinger}) {
+        sum = 0;
+        start = high_resolution_clock::now();
+        for (const auto& p : probes) {
+            sum += idx->lowerBound(p);
+        }
+        end = high_resolution_clock::now();
+        string name = idx == &binary ? "PACKED BINARY" : "EYTZINGER";
+        printResult(name, INDEX_LOOKUPS, duration_cast<milliseconds>(end - start));
+        if (sum != check) { // 和 std::lower_bound 的结果对不上，计时没有意义
+            cerr << "Error: " << name << " disagrees with std::lower_bound" << endl;
+            exit(1);
+        }
+    }
+}
+
+void test_filter_policy() {
+    printHeader("FILTER POLICY (FPR AND PROBE THROUGHPUT)");
+    
+    for (uint64_t bitsPerKey : {16, 10, 6}) {
+        uint64_t n = 8 * M / bitsPerKey; // 过滤器大小固定，key 数决定每个 key 的位数
+        for (filterPolicy policy : {FILTER_BLOOM, FILTER_BLOCKED}) {
+            bloom filter(policy, M);
+            for (uint64_t i = 0; i < n; i++) {
+                filter.insert(i * 2); // 偶数在表里，奇数用来测假阳性
+            }
+            
+            uint64_t positives = 0;
+            auto start = high_resolution_clock::now();
+            for (uint64_t i = 0; i < FILTER_PROBES; i++) {
+                positives += filter.search(i * 2 + 1);
+            }
+            auto end = high_resolution_clock::now();
+            
+            printResult(string(policy == FILTER_BLOOM ? "BLOOM " : "BLOCKED ") + to_string(bitsPerKey) + "b/key",
+                        FILTER_PROBES, duration_cast<milliseconds>(end - start));
+            cout << "  " << left << setw(15) << "FPR" << ": " << fixed << setprecision(3) << right << setw(9)
+                 << (double)positives / FILTER_PROBES * 100 << "%" << endl
+                 << endl;
+        }
+    }
+}
+
+void test_static_filter() {
+    printHeader("XOR8 VS BLOOM (" + to_string(STATIC_FILTER_KEYS) + " KEYS)");
+    
+    vector<uint64_t> keys(STATIC_FILTER_KEYS);
+    for (auto& key : keys) {
+        key = gen() | 1; // 奇数在表里，偶数用来测假阳性
+    }
+    
+    // bloom 取和 Xor8 (约 1/256) 相近的假阳性率
+    for (auto [policy, bitsPerKey] : {pair{FILTER_BLOOM, 14.0}, pair{FILTER_BLOCKED, 14.0}, pair{FILTER_XOR8, 0.0}}) {
+        bloom filter(policy);
+        auto start = high_resolution_clock::now();
+        filter.build(keys, bitsPerKey);
+        auto end = high_resolution_clock::now();
+        auto buildTime = duration_cast<milliseconds>(end - start);
+        
+        uint64_t positives = 0, missed = 0;
+        start = high_resolution_clock::now();
+        for (uint64_t i = 0; i < FILTER_PROBES; i++) {
+            positives += filter.search(gen() & ~1ull);
+        }
+        end = high_resolution_clock::now();
+        for (const auto& key : keys) {
+            missed += !filter.search(key);
+        }
+        assert(missed == 0);
+        
+        string name = policy == FILTER_BLOOM ? "BLOOM" : policy == FILTER_BLOCKED ? "BLOCKED" : "XOR8";
+        printResult(name, FILTER_PROBES, duration_cast<milliseconds>(end - start));
+        cout << "  " << left << setw(15) << "Bits per key" << ": " << fixed << setprecision(2) << right << setw(9)
+             << (double)filter.size() * 8 / keys.size() << endl;
+        cout << "  " << left << setw(15) << "Build" << ": " << right << setw(9) << buildTime.count() << " ms" << endl;
+        cout << "  " << left << setw(15) << "FPR" << ": " << fixed << setprecision(3) << right << setw(9)
+             << (double)positives / FILTER_PROBES * 100 << "%" << endl
+             << endl;
+    }
+}
+
+void test_short_scan(KVStore& store) {
+    printHeader("SHORT SCANS OVER SPARSE KEYS");
+    
+    vector<uint64_t> keys(SPARSE_KEYS);
+    WriteBatch batch;
+    for (auto& key : keys) {
+        key = gen() % (1ull << 40); // 每张表的 [minV, maxV] 都几乎覆盖整个键空间
+        batch.put(key, generate_value(64));
+        if (batch.count() == 1024) {
+            store.write(batch);
+            batch.clear();
+        }
+    }
+    store.write(batch);
+    
+    vector<uint64_t> starts(SHORT_SCANS);
+    for (uint64_t i = 0; i < SHORT_SCANS; i++) {
+        starts[i] = i % 2 ? keys[gen() % keys.size()] : gen() % (1ull << 40); // 一半命中，一半落在空隙里
+    }
+    
+    for (bool on : {false, true}) {
+        store.setRangeFilter(on);
+        uint64_t found = 0;
+        auto start = high_resolution_clock::now();
+        
+        for (const auto& key : starts) {
+            list<pair<uint64_t, string>> result;
+            store.scan(key, key + SHORT_SCAN_WIDTH, result);
+            found += result.size();
+        }
+        
+        auto end = high_resolution_clock::now();
+        printResult(on ? "RANGE FILTER" : "MIN/MAX ONLY", SHORT_SCANS, duration_cast<milliseconds>(end - start));
+        cout << "  " << left << setw(15) << "Keys returned" << ": " << right << setw(9) << found << endl << endl;
+    }
+}
+
+void test_iterator(KVStore& store) {
+    printHeader("ITERATOR VS FULL SCAN");
+    
+    WriteBatch batch;
+    for (uint64_t i = 0; i < ITER_KEYS; i++) {
+        batch.put(i, generate_value(256));
+        if (batch.count() == 1024) {
+            store.write(batch);
+            batch.clear();
+        }
+    }
+    store.write(batch);
+    
+    vector<uint64_t> starts(ITER_SCANS);
+    for (auto& key : starts) {
+        key = gen() % (ITER_KEYS / 2);
+    }
+    
+    // 只要前 ITER_ROWS 行：旧的做法是把整个区间都扫出来再截断
+    uint64_t found = 0;
+    auto start = high_resolution_clock::now();
+    for (const auto& key : starts) {
+        list<pair<uint64_t, string>> result;
+        store.scan(key, INF, result);
+        found += min<uint64_t>(result.size(), ITER_ROWS);
+    }
+    auto end = high_resolution_clock::now();
+    printResult("FULL SCAN", ITER_SCANS, duration_cast<milliseconds>(end - start));
+    cout << "  " << left << setw(15) << "Keys used" << ": " << right << setw(9) << found << endl << endl;
+    
+    found = 0;
+    start = high_resolution_clock::now();
+    for (const auto& key : starts) {
+        unique_ptr<Iterator> it = store.new_iterator();
+        uint64_t rows = 0;
+        for (it->seek(key); it->valid() && rows < ITER_ROWS; it->next()) {
+            rows++;
+        }
+        found += rows;
+    }
+    end = high_resolution_clock::now();
+    printResult("ITERATOR", ITER_SCANS, duration_cast<milliseconds>(end - start));
+    cout << "  " << left << setw(15) << "Keys used" << ": " << right << setw(9) << found << endl << endl;
+    
+    // 从区间末尾往回取
+    found = 0;
+    start = high_resolution_clock::now();
+    for (const auto& key : starts) {
+        unique_ptr<Iterator> it = store.new_iterator(0, key + ITER_KEYS / 2);
+        uint64_t rows = 0;
+        for (it->seekToLast(); it->valid() && rows < ITER_ROWS; it->prev()) {
+            rows++;
+        }
+        found += rows;
+    }
+    end = high_resolution_clock::now();
+    printResult("REVERSE", ITER_SCANS, duration_cast<milliseconds>(end - start));
+    cout << "  " << left << setw(15) << "Keys used" << ": " << right << setw(9) << found << endl << endl;
+}
+
+// 把 dir 下所有文件踢出页缓存，之后的读都要访问设备
+void dropPageCache(const string& dir) {
+    for (const auto& entry : filesystem::recursive_directory_iterator(dir)) {
+        if (!entry.is_regular_file()) {
+            continue;
+        }
+        int fd = open(entry.path().c_str(), O_RDONLY);
+        if (fd >= 0) {
+            fdatasync(fd); // 脏页踢不掉，先写回
+            posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+            close(fd);
+        }
+    }
+}
+
+void test_long_scan(KVStore& store) {
+    printHeader("LONG SCAN READAHEAD (COLD PAGE CACHE)");
+    
+    WriteBatch batch;
+    for (uint64_t i = 0; i < LONG_SCAN_KEYS; i++) {
+        batch.put(i, generate_value(LONG_SCAN_VALUE));
+        if (batch.count() == 256) {
+            store.write(batch);
+            batch.clear();
+        }
+    }
+    store.write(batch);
+    
+    store.setBlockCacheCapacity(0); // 只比较读文件的方式
+    for (bool on : {false, true}) {
+        store.setReadahead(on);
+        dropPageCache("./data");
+        uint64_t bytes = 0;
+        auto start = high_resolution_clock::now();
+        
+        unique_ptr<Iterator> it = store.new_iterator();
+        for (it->seekToFirst(); it->valid(); it->next()) {
+            bytes += it->value().size();
+        }
+        
+        auto end = high_resolution_clock::now();
+        double seconds = duration_cast<microseconds>(end - start).count() / 1e6;
+        printResult(on ? "READAHEAD" : "BLOCK BY BLOCK", LONG_SCAN_KEYS, duration_cast<milliseconds>(end - start));
+        cout << "  " << left << setw(15) << "Bandwidth" << ": " << fixed << setprecision(1) << right << setw(9)
+             << bytes / seconds / (1024 * 1024) << " MB/s" << endl << endl;
+    }
+    store.setBlockCacheCapacity(BLOCK_CACHE_CAPACITY);
+}
+
+void test_parallel_scan(KVStore& store) {
+    printHeader("PARALLEL FULL-TABLE SCAN");
+    
+    WriteBatch batch;
+    for (uint64_t i = 0; i < PARALLEL_SCAN_KEYS; i++) {
+        batch.put(random_key() << 20 | i, generate_value(256)); // key 打散，每层都有数据
+        if (batch.count() == 1024) {
+            store.write(batch);
+            batch.clear();
+        }
+    }
+    store.write(batch);
+    cout << "  Hardware threads: " << thread::hardware_concurrency() << endl << endl;
+    
+    for (bool ordered : {true, false}) {
+        for (unsigned threads : {1, 2, 4, 8}) {
+            atomic<uint64_t> rows(0);
+            auto start = high_resolution_clock::now();
+            store.parallel_scan(0, INF, [&](uint64_t, string_view) { rows++; }, threads, ordered);
+            auto end = high_resolution_clock::now();
+            printResult((ordered ? "ORDERED x" : "UNORDERED x") + to_string(threads), rows,
+                        duration_cast<milliseconds>(end - start));
+        }
+    }
+}
+
+void test_snapshot(KVStore& store) {
+    printHeader("SNAPSHOT");
+    
+    WriteBatch batch;
+    for (uint64_t i = 0; i < SNAPSHOT_KEYS; i++) {
+        batch.put(i, generate_value(256));
+        if (batch.count() == 1024) {
+            store.write(batch);
+            batch.clear();
+        }
+    }
+    store.write(batch);
+    
+    // 没有写入时快照共用同一份 memtable 副本；每次之间有写入时要重新复制
+    for (bool writes : {false, true}) {
+        auto start = high_resolution_clock::now();
+        for (uint64_t i = 0; i < SNAPSHOT_TAKES; i++) {
+            if (writes)
+                store.put(i % SNAPSHOT_KEYS, generate_value(256));
+            store.release_snapshot(store.get_snapshot());
+        }
+        auto end = high_resolution_clock::now();
+        printResult(writes ? "TAKE+PUT" : "TAKE", SNAPSHOT_TAKES, duration_cast<milliseconds>(end - start));
+    }
+    
+    // 读快照的同时另一个线程持续写入，写入会触发 flush 和 compaction
+    for (bool writes : {false, true}) {
+        const Snapshot *snap = store.get_snapshot();
+        atomic<bool> stop(false);
+        thread writer([&]() {
+            for (uint64_t i = 0; writes && !stop; i++)
+                store.put(SNAPSHOT_KEYS + i % SNAPSHOT_KEYS, generate_value(256));
+        });
+        uint64_t found = 0;
+        auto start = high_resolution_clock::now();
+        for (uint64_t i = 0; i < SNAPSHOT_GETS; i++)
+            found += !store.get(random_key() % SNAPSHOT_KEYS, snap).empty();
+        auto end = high_resolution_clock::now();
+        stop = true;
+        writer.join();
+        store.release_snapshot(snap);
+        printResult(writes ? "GET+WRITER" : "GET", SNAPSHOT_GETS, duration_cast<milliseconds>(end - start), found,
+                    SNAPSHOT_GETS);
+    }
+}
+
+void test_concurrent_get(KVStore& store) {
+    printHeader("CONCURRENT GET");
+    
+    WriteBatch batch;
+    for (uint64_t i = 0; i < CONCURRENT_KEYS; i++) {
+        batch.put(i, generate_value(256));
+        if (batch.count() == 1024) {
+            store.write(batch);
+            batch.clear();
+        }
+    }
+    store.write(batch);
+    cout << "  Hardware threads: " << thread::hardware_concurrency() << endl << endl;
+    
+    // 读线程共分 CONCURRENT_GETS 次 get，不加锁读当前版本；写线程的 flush 和 compaction 会不断装入新版本
+    for (bool writes : {false, true}) {
+        for (unsigned threads : {1, 2, 4, 8}) {
+            atomic<bool> stop(false);
+            thread writer([&]() {
+                for (uint64_t i = 0; writes && !stop; i++)
+                    store.put(CONCURRENT_KEYS + i % CONCURRENT_KEYS, generate_value(256));
+            });
+            atomic<uint64_t> found(0);
+            vector<thread> readers;
+            auto start = high_resolution_clock::now();
+            for (unsigned t = 0; t < threads; t++) {
+                readers.emplace_back([&, t]() {
+                    mt19937_64 rng(t); // 全局的 gen 不能多线程共用
+                    uint64_t hit = 0;
+                    for (uint64_t i = 0; i < CONCURRENT_GETS / threads; i++)
+                        hit += !store.get(rng() % CONCURRENT_KEYS).empty();
+                    found += hit;
+                });
+            }
+            for (auto& r : readers)
+                r.join();
+            auto end = high_resolution_clock::now();
+            stop = true;
+            writer.join();
+            printResult((writes ? "GET+WRITER x" : "GET x") + to_string(threads), CONCURRENT_GETS,
+                        duration_cast<milliseconds>(end - start), found, CONCURRENT_GETS);
+        }
+    }
+}
+
 void test_del(KVStore& store, const vector<uint64_t>& keys) {
     printHeader("DELETE PERFORMANCE");
     
@@ -124,8 +844,105 @@ void test_del(KVStore& store, const vector<uint64_t>& keys) {
     printResult("DELETE", keys.size(), duration, deleted, keys.size());
 }
 
-void test_mixed_workload(KVStore& store) {
-    printHeader("MIXED WORKLOAD PERFORMANCE");
+void test_del_blind(KVStore& store, const vector<uint64_t>& keys) {
+    printHeader("BLIND DELETE PERFORMANCE");
+    
+    auto start = high_resolution_clock::now();
+    
+    for (const auto& key : keys) {
+        store.del_blind(key);
+    }
+    
+    auto end = high_resolution_clock::now();
+    auto duration = duration_cast<milliseconds>(end - start);
+    
+    printResult("DEL_BLIND", keys.size(), duration);
+}
+
+void test_del_range(KVStore& store, const vector<uint64_t>& keys) {
+    printHeader("RANGE DELETE PERFORMANCE");
+    
+    uint64_t lo = *min_element(keys.begin(), keys.end());
+    uint64_t hi = *max_element(keys.begin(), keys.end());
+    
+    // scan followed by one delete per key
+    auto start = high_resolution_clock::now();
+    
+    list<pair<uint64_t, string>> rows;
+    store.scan(lo, hi, rows);
+    for (const auto& row : rows) {
+        store.del(row.first);
+    }
+    
+    auto end = high_resolution_clock::now();
+    printResult("SCAN+DEL", rows.size(), duration_cast<milliseconds>(end - start));
+    
+    for (uint64_t i = 0; i < keys.size(); i++) {
+        store.put(keys[i], generate_value(64));
+    }
+    
+    // one range tombstone
+    start = high_resolution_clock::now();
+    
+    store.del_range(lo, hi);
+    
+    end = high_resolution_clock::now();
+    cout << "  DEL_RANGE      : " << rows.size() << " keys in "
+         << duration_cast<microseconds>(end - start).count() << " us" << endl;
+    
+    uint64_t found = 0;
+    for (const auto& key : keys) {
+        if (!store.get(key).empty()) {
+            found++;
+        }
+    }
+    cout << "  Keys still visible: " << found << endl << endl;
+}
+
+void test_merge(KVStore& store, const vector<uint64_t>& keys) {
+    printHeader("MERGE PERFORMANCE");
+    
+    store.setMergeOperator([](uint64_t, const string *existing, const string &operand) {
+        return to_string((existing ? stoull(*existing) : 0) + stoull(operand));
+    });
+    
+    // read-modify-write counter
+    auto start = high_resolution_clock::now();
+    
+    for (const auto& key : keys) {
+        string old = store.get(key);
+        store.put(key, to_string((old.empty() ? 0 : stoull(old)) + 1));
+    }
+    
+    auto end = high_resolution_clock::now();
+    printResult("GET+PUT", keys.size(), duration_cast<milliseconds>(end - start));
+    
+    // same counter without reading the old value
+    start = high_resolution_clock::now();
+    
+    for (const auto& key : keys) {
+        store.merge(key, "1");
+    }
+    
+    end = high_resolution_clock::now();
+    printResult("MERGE", keys.size(), duration_cast<milliseconds>(end - start));
+    
+    // reads now fold the pending operands
+    start = high_resolution_clock::now();
+    
+    for (const auto& key : keys) {
+        store.get(key);
+    }
+    
+    end = high_resolution_clock::now();
+    printResult("GET AFTER MERGE", keys.size(), duration_cast<milliseconds>(end - start));
+    
+    store.setMergeOperator(appendOperator);
+}
+
+void test_mixed_workload(KVStore& store, bool blindDelete = false) {
+    printHeader(string("MIXED WORKLOAD PERFORMANCE") + (blindDelete ? " (BLIND DELETE)" : ""));
+    store.setBlindDelete(blindDelete);
     
     vector<pair<int, uint64_t>> operations; // (op_type, key)
     operations.reserve(TEST_MAX);
@@ -185,6 +1002,65 @@ void test_mixed_workload(KVStore& store) {
     cout << "    PUT: " << puts << " operations (" << fixed << setprecision(1) << (double)puts/TEST_MAX*100 << "%)" << endl;
     cout << "    GET: " << gets << " operations (" << fixed << setprecision(1) << (double)gets/TEST_MAX*100 << "%)" << endl;
     cout << "    DEL: " << dels << " operations (" << fixed << setprecision(1) << (double)dels/TEST_MAX*100 << "%)" << endl;
+
+    store.setBlindDelete(false);
+}
+
+void test_wal_sync_modes(KVStore& store) {
+    printHeader("WAL SYNC MODE PERFORMANCE");
+
+    const vector<pair<SYNCMODE, string>> modes = {
+        {SYNC_NONE, "NONE"}, {SYNC_EVERY, "FSYNC"}, {SYNC_GROUP, "GROUP"}};
+
+    vector<string> values(WAL_TEST_MAX);
+    for (uint64_t i = 0; i < WAL_TEST_MAX; i++) {
+        values[i] = generate_value(128);
+    }
+
+    cout << "  Single writer through KVStore::put..." << endl;
+    for (const auto& mode : modes) {
+        store.reset();
+        store.setSyncMode(mode.first);
+
+        auto start = high_resolution_clock::now();
+        for (uint64_t i = 0; i < WAL_TEST_MAX; i++) {
+            store.put(i + 1, values[i]);
+        }
+        auto end = high_resolution_clock::now();
+
+        printResult("PUT " + mode.second, WAL_TEST_MAX, duration_cast<milliseconds>(end - start));
+    }
+    store.setSyncMode(SYNC_NONE);
+    store.reset();
+
+    // group commit only pays off with concurrent writers sharing one fdatasync
+    cout << "  " << WAL_THREADS << " concurrent writers appending to the log..." << endl;
+    const string path = "./data/wal_bench.log";
+    for (const auto& mode : modes) {
+        {
+            wal log(path);
+            log.setMode(mode.first);
+
+            auto start = high_resolution_clock::now();
+            vector<thread> writers;
+            for (int t = 0; t < WAL_THREADS; t++) {
+                writers.emplace_back([&, t]() {
+                    for (uint64_t i = t; i < WAL_TEST_MAX; i += WAL_THREADS) {
+                        wal::record rec;
+                        rec.add(wal::OP_PUT, i + 1, values[i]);
+                        log.sync(log.append(rec));
+                    }
+                });
+            }
+            for (auto& w : writers) {
+                w.join();
+            }
+            auto end = high_resolution_clock::now();
+
+            printResult("APPEND " + mode.second, WAL_TEST_MAX, duration_cast<milliseconds>(end - start));
+        }
+        remove(path.c_str());
+    }
 }
 
 int main() {
@@ -214,13 +1090,90 @@ int main() {
     // Test with random keys
     test_put(store, random_keys, false);
     test_get(store, random_keys);
+    test_get_missing(store, random_keys);
+    test_get_allocs(store);
+    test_zipf_get(store, random_keys);
     test_del(store, random_keys);
     
     store.reset();
     
+    // Test blind deletes on the same data
+    test_put(store, random_keys, false);
+    test_del_blind(store, random_keys);
+    
+    store.reset();
+    
+    // Test dropping a whole key range
+    test_put(store, sequential_keys, true);
+    test_del_range(store, sequential_keys);
+    
+    store.reset();
+    
+    // Test index memory of the block-based format
+    test_index_memory(store);
+    test_index_search();
+    test_filter_policy();
+    test_static_filter();
+    
+    store.reset();
+    
+    // Test hot point lookups served from the row cache
+    test_row_cache(store);
+    
+    store.reset();
+    
+    // Test batched point lookups against a get loop
+    test_multi_get(store);
+    test_async_read();
+    
+    store.reset();
+    
+    // Test short scans that the range filter can skip
+    test_short_scan(store);
+    
+    store.reset();
+    
+    // Test an iterator that stops early against a full scan
+    test_iterator(store);
+    
+    store.reset();
+    
+    // Test a long scan reading tables sequentially
+    test_long_scan(store);
+    
+    store.reset();
+    
+    // Test a full-table scan split across threads
+    test_parallel_scan(store);
+    
+    store.reset();
+    
+    // Test snapshot creation and snapshot reads next to a writer
+    test_snapshot(store);
+    
+    store.reset();
+    
+    // Test gets from several reader threads, with and without a writer
+    test_concurrent_get(store);
+    
+    store.reset();
+    
+    // Test counters updated by merge instead of get+put
+    test_merge(store, random_keys);
+    
+    store.reset();
+    
     // Test mixed workload
     test_mixed_workload(store);
     
+    store.reset();
+    
+    // Same mix with deletes that skip the read path
+    test_mixed_workload(store, true);
+
+    // Test WAL sync modes
+    test_wal_sync_modes(store);
+    
     printHeader("PERFORMANCE TESTING SUMMARY");
     cout << "  All tests completed successfully." << endl;
     cout << "  Total test data size: " << (TEST_MAX * 3) << " entries" << endl;
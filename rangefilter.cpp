@@ -0,0 +1,46 @@
+#include "rangefilter.h"
+
+#include <cstddef>
+
+static uint64_t prefixKey(uint64_t key, int level) { // 不同档的前缀不能相撞
+    return (key >> RANGE_SHIFT[level]) << 2 | level;
+}
+
+void rangeBuild(bloom &filter, const std::vector<uint64_t> &keys) {
+    std::vector<uint64_t> prefixes;
+    for (int level = 0; level < RANGE_LEVELS; ++level) {
+        for (size_t i = 0; i < keys.size(); ++i) { // key 有序，相同的前缀连在一起
+            if (!i || keys[i] >> RANGE_SHIFT[level] != keys[i - 1] >> RANGE_SHIFT[level])
+                prefixes.push_back(prefixKey(keys[i], level));
+        }
+    }
+    filter.reset(FILTER_BLOCKED, 0);
+    filter.build(prefixes, RANGE_BITS_PER_PREFIX);
+}
+
+int rangePrefixes(uint64_t prev, uint64_t key) {
+    int n = 0;
+    for (int level = 0; level < RANGE_LEVELS; ++level)
+        n += key >> RANGE_SHIFT[level] != prev >> RANGE_SHIFT[level];
+    return n;
+}
+
+uint32_t rangeBytes(uint64_t prefixes) {
+    return bloom::bytesFor(prefixes, RANGE_BITS_PER_PREFIX);
+}
+
+bool rangeMayOverlap(const bloom &filter, uint64_t lo, uint64_t hi) {
+    if (!filter.size())
+        return true;
+    for (int level = 0; level < RANGE_LEVELS; ++level) {
+        uint64_t a = lo >> RANGE_SHIFT[level], b = hi >> RANGE_SHIFT[level];
+        if (b - a >= RANGE_PROBES)
+            continue; // 这一档的前缀太多，换更粗的一档
+        for (uint64_t p = a; p <= b; ++p) {
+            if (filter.search(prefixKey(p << RANGE_SHIFT[level], level)))
+                return true;
+        }
+        return false;
+    }
+    return true;
+}
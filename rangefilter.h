@@ -0,0 +1,29 @@
+#pragma once
+
+#ifndef LSM_KV_RANGEFILTER_H
+#define LSM_KV_RANGEFILTER_H
+
+#include "bloom.h"
+
+#include <cstdint>
+#include <vector>
+
+/*
+ * 前缀 bloom 范围过滤器：对 RANGE_SHIFT 中的每一档 s，把每个 key 的前缀 key >> s 放进同一个分块过滤器。
+ * 查询 [lo, hi] 时取最细的一档使区间只覆盖不超过 RANGE_PROBES 个前缀，逐个探测；
+ * 都不在就说明区间里肯定没有 key。区间太宽时不作判断。
+ */
+const int RANGE_SHIFT[]            = {6, 12, 18};
+const int RANGE_LEVELS             = 3;
+const uint64_t RANGE_PROBES        = 4;
+const double RANGE_BITS_PER_PREFIX = 10;
+
+void rangeBuild(bloom &filter, const std::vector<uint64_t> &keys); // keys 有序
+
+int rangePrefixes(uint64_t prev, uint64_t key); // 按序追加 key 时新增的前缀数，prev 是前一个 key
+
+uint32_t rangeBytes(uint64_t prefixes); // 放进 prefixes 个前缀时 rangeBuild 建出的字节数
+
+bool rangeMayOverlap(const bloom &filter, uint64_t lo, uint64_t hi); // 没有建过滤器时总是返回 true
+
+#endif // LSM_KV_RANGEFILTER_H
@@ -0,0 +1,108 @@
+#include "rowcache.h"
+
+rowcache::rowcache(size_t capacity, int shardBits) :
+    shards(1 << shardBits), enabled(false), hits(0), misses(0), inserts(0), evictions(0) {
+    setCapacity(capacity);
+}
+
+rowcache::shard &rowcache::shardOf(uint64_t key) {
+    return shards[(key * 0x9e3779b97f4a7c15ull) >> 32 & (shards.size() - 1)];
+}
+
+void rowcache::shard::evict(size_t need, std::atomic<uint64_t> &evictions) {
+    while (usage + need > capacity && !lru.empty()) {
+        const entry &victim = lru.back();
+        usage -= victim.value.size() + ROW_OVERHEAD;
+        table.erase(victim.key);
+        lru.pop_back();
+        evictions++;
+    }
+}
+
+bool rowcache::lookup(uint64_t key, std::string &value, uint64_t &epoch) {
+    if (!enabled)
+        return false;
+    shard &sh = shardOf(key);
+    std::lock_guard<std::mutex> lock(sh.mtx);
+    auto it = sh.table.find(key);
+    if (it == sh.table.end()) {
+        misses++;
+        epoch = sh.epoch;
+        return false;
+    }
+    sh.lru.splice(sh.lru.begin(), sh.lru, it->second); // 移到表头
+    value = it->second->value;
+    hits++;
+    return true;
+}
+
+void rowcache::insert(uint64_t key, const std::string &value, uint64_t epoch) {
+    if (!enabled)
+        return;
+    shard &sh   = shardOf(key);
+    size_t need = value.size() + ROW_OVERHEAD;
+    std::lock_guard<std::mutex> lock(sh.mtx);
+    if (sh.epoch != epoch || need > sh.capacity)
+        return; // 读的过程中有写入，或者放不下
+    auto it = sh.table.find(key);
+    if (it != sh.table.end()) { // 并发读同一个 key，换成新的
+        sh.usage -= it->second->value.size() + ROW_OVERHEAD;
+        sh.lru.erase(it->second);
+        sh.table.erase(it);
+    }
+    sh.evict(need, evictions);
+    sh.lru.push_front(entry{key, value});
+    sh.table[key] = sh.lru.begin();
+    sh.usage += need;
+    inserts++;
+}
+
+void rowcache::erase(uint64_t key) {
+    if (!enabled)
+        return;
+    shard &sh = shardOf(key);
+    std::lock_guard<std::mutex> lock(sh.mtx);
+    sh.epoch++;
+    auto it = sh.table.find(key);
+    if (it == sh.table.end())
+        return;
+    sh.usage -= it->second->value.size() + ROW_OVERHEAD;
+    sh.lru.erase(it->second);
+    sh.table.erase(it);
+}
+
+void rowcache::clear() {
+    for (shard &sh : shards) {
+        std::lock_guard<std::mutex> lock(sh.mtx);
+        sh.epoch++;
+        sh.lru.clear();
+        sh.table.clear();
+        sh.usage = 0;
+    }
+}
+
+void rowcache::setCapacity(size_t capacity) {
+    for (shard &sh : shards) {
+        std::lock_guard<std::mutex> lock(sh.mtx);
+        sh.capacity = capacity / shards.size();
+        sh.evict(0, evictions);
+    }
+    enabled = capacity > 0;
+}
+
+rowcache::stats rowcache::getStats() {
+    stats res{hits, misses, inserts, evictions, 0, 0};
+    for (shard &sh : shards) {
+        std::lock_guard<std::mutex> lock(sh.mtx);
+        res.usage += sh.usage;
+        res.capacity += sh.capacity;
+    }
+    return res;
+}
+
+void rowcache::resetStats() {
+    hits      = 0;
+    misses    = 0;
+    inserts   = 0;
+    evictions = 0;
+}
@@ -0,0 +1,68 @@
+#pragma once
+
+#ifndef LSM_KV_ROWCACHE_H
+#define LSM_KV_ROWCACHE_H
+
+#include <atomic>
+#include <cstdint>
+#include <list>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+const size_t ROW_CACHE_CAPACITY = 0; // 默认关闭
+const int ROW_CACHE_SHARD_BITS  = 4;
+const size_t ROW_OVERHEAD       = 64; // 每一项除 value 以外大约占用的字节数，计入容量
+
+/*
+ * 行缓存：key -> get 的结果（空串表示不存在），命中时不用再查 memtable 和 sstable。
+ * 分片和淘汰方式与 blockcache 相同。写入时按 key 失效；范围删除、换 merge 操作符时整个清空。
+ * 读者在 lookup 未命中时拿到所在分片的版本号，insert 时版本号变了（期间有写入失效过）就放弃，
+ * 避免把并发写入之前读到的旧值放进缓存。
+ */
+class rowcache {
+public:
+    struct stats {
+        uint64_t hits, misses, inserts, evictions;
+        size_t usage, capacity;
+    };
+
+private:
+    struct entry {
+        uint64_t key;
+        std::string value;
+    };
+
+    struct shard {
+        std::mutex mtx;
+        std::list<entry> lru; // 表头是最近使用的
+        std::unordered_map<uint64_t, std::list<entry>::iterator> table;
+        size_t usage    = 0;
+        size_t capacity = 0;
+        uint64_t epoch  = 0; // 每次失效加一
+
+        void evict(size_t need, std::atomic<uint64_t> &evictions);
+    };
+
+    std::vector<shard> shards;
+    std::atomic<bool> enabled;
+    std::atomic<uint64_t> hits, misses, inserts, evictions;
+
+    shard &shardOf(uint64_t key);
+
+public:
+    rowcache(size_t capacity = ROW_CACHE_CAPACITY, int shardBits = ROW_CACHE_SHARD_BITS);
+
+    bool lookup(uint64_t key, std::string &value, uint64_t &epoch); // 未命中时 epoch 返回给 insert 用
+    void insert(uint64_t key, const std::string &value, uint64_t epoch);
+    void erase(uint64_t key); // key 被写入
+    void clear();             // 所有 key 都可能变了
+
+    void setCapacity(size_t capacity); // 0 表示不缓存
+
+    stats getStats();
+    void resetStats();
+};
+
+#endif // LSM_KV_ROWCACHE_H
@@ -17,105 +17,203 @@ int skiplist::randLevel() {
     return level;
 }
 
+/**
+ * Copy every node and range tombstone of other. Nodes are appended in key
+ * order, so each level only needs its current last node; levels are drawn
+ * again rather than copied.
+ */
+skiplist::skiplist(const skiplist &other) : skiplist(other.p) {
+    slnode *last[MAX_LEVEL]; // 每一层目前的最后一个节点
+    for (int i = 0; i < MAX_LEVEL; ++i)
+        last[i] = head;
+    for (slnode *cur = other.head->next(0); cur != other.tail; cur = cur->next(0)) {
+        int level     = randLevel();
+        slnode *nnode = new slnode(cur->key, cur->val, NORMAL);
+        curMaxL       = std::max(curMaxL.load(), level);
+        for (int i = 0; i < level; ++i) {
+            nnode->nxt[i] = tail;
+            last[i]->link(i, nnode);
+            last[i] = nnode;
+        }
+    }
+    bytes   = other.bytes;
+    count   = other.count;
+    ranges  = other.ranges;
+    version = other.getVersion();
+}
+
+skiplist::~skiplist() {
+    reset();
+    delete head;
+    delete tail;
+}
+
 void skiplist::insert(uint64_t key, const std::string &str) {
+    version++;
     slnode *update[MAX_LEVEL];
     slnode *cur = head;
-    for (int i = curMaxL - 1; i >= 0; --i) {
-        while (cur->nxt[i]->key < key)
-            cur = cur->nxt[i];
+    int maxL    = curMaxL.load(std::memory_order_relaxed);
+    for (int i = maxL - 1; i >= 0; --i) {
+        while (cur->next(i)->key < key)
+            cur = cur->next(i);
         update[i] = cur;
     }
 
-    if (cur->nxt[0]->key == key) {
-        cur->nxt[0]->val = str;
+    slnode *found = cur->next(0);
+    if (found->key == key) {
+        bytes = bytes - found->val.length() + str.length(); // 覆盖旧值
+        found->setValue(str);
         return;
     }
 
     int level = randLevel();
-    if (level > curMaxL) {
-        for (int i = curMaxL; i < level; ++i)
+    if (level > maxL) {
+        for (int i = maxL; i < level; ++i)
             update[i] = head;
-        curMaxL = level;
+        curMaxL.store(level, std::memory_order_relaxed); // 读者从更高层开始也只会看到 tail
     }
     slnode *nnode = new slnode(key, str, NORMAL);
-    for (int i = 0; i < level; ++i) {
-        nnode->nxt[i] = update[i]->nxt[i];
-        update[i]->nxt[i] = nnode;
-    }
+    for (int i = 0; i < level; ++i)
+        nnode->nxt[i].store(update[i]->next(i), std::memory_order_relaxed);
+    for (int i = 0; i < level; ++i) // 从下往上接进去，读者在哪一层看到它都能接着往后走
+        update[i]->link(i, nnode);
 
     bytes += 12;            // Index
     bytes += str.length();  // Data
+    count++;
 }
 
 std::string skiplist::search(uint64_t key) {
     slnode *cur = lowerBound(key);
     if (cur->key == key) {
-        return cur->val;
+        return cur->value();
     }
     return "";
 }
 
-bool skiplist::del(uint64_t key) {
-    slnode *update[MAX_LEVEL];
-    slnode *cur = head;
-    for (int i = curMaxL - 1; i >= 0; --i) {
-        while (cur->nxt[i]->key < key)
-            cur = cur->nxt[i];
-        update[i] = cur;
+/**
+ * Look up ascending keys in one pass. Each descent starts from the nodes
+ * where the previous one left each level, so nearby keys only walk the
+ * gap between them instead of coming down from the head again.
+ */
+void skiplist::searchSorted(const std::vector<uint64_t> &keys, std::vector<std::string> &vals) {
+    slnode *pred[MAX_LEVEL]; // 上一个 key 在每一层的前驱，key 都比它小
+    for (int i = 0; i < MAX_LEVEL; ++i)
+        pred[i] = head;
+    vals.assign(keys.size(), "");
+    int maxL = curMaxL.load(std::memory_order_relaxed);
+    for (size_t k = 0; k < keys.size(); ++k) {
+        slnode *cur = head;
+        for (int i = maxL - 1; i >= 0; --i) {
+            if (pred[i] != head && (cur == head || pred[i]->key > cur->key))
+                cur = pred[i];
+            while (cur->next(i)->key < keys[k])
+                cur = cur->next(i);
+            pred[i] = cur;
+        }
+        slnode *found = cur->next(0);
+        if (found->key == keys[k] && found->type == NORMAL)
+            vals[k] = found->value();
     }
+}
 
-    if (cur->nxt[0]->key != key)
+bool skiplist::del(uint64_t key) {
+    if (lowerBound(key)->key != key)
         return false;
+    insert(key, DEL); // 节点留着，读者可能正停在上面
+    return true;
+}
 
-    slnode *delNode = cur->nxt[0];
-    bytes -= 12;                        // Index
-    bytes -= delNode->val.length();     // Data
-    for (int i = 0; i < curMaxL; ++i) {
-        if (update[i]->nxt[i] == delNode)
-            update[i]->nxt[i] = delNode->nxt[i];
+/**
+ * Mark every node in [key1, key2] deleted and record the range. Nodes are
+ * overwritten with DEL instead of being unlinked, since readers may be
+ * walking over them; the ranges are replaced by a new list for the same
+ * reason.
+ */
+void skiplist::delRange(uint64_t key1, uint64_t key2) {
+    version++;
+    for (slnode *cur = lowerBound(key1); cur != tail && cur->key <= key2; cur = cur->next(0)) {
+        if (cur->val == DEL)
+            continue;
+        bytes = bytes - cur->val.length() + DEL.length();
+        cur->setValue(DEL);
     }
-    delete delNode;
-    while (curMaxL > 1 && head->nxt[curMaxL - 1] == tail)
-        curMaxL--;
 
-    insert(key, DEL);
-    
-    return true;
+    auto merged   = std::make_shared<std::vector<rangeDel>>(*ranges);
+    size_t before = merged->size();
+    mergeRange(*merged, rangeDel(key1, key2));
+    bytes  = bytes + 16 * merged->size() - 16 * before; // 每个范围删除在 sstable 中占 16 字节
+    ranges = merged;
+}
+
+bool skiplist::covered(uint64_t key) {
+    return rangeCovers(*ranges, key);
+}
+
+void mergeRange(std::vector<rangeDel> &ranges, rangeDel r) {
+    auto it = std::lower_bound(ranges.begin(), ranges.end(), r);
+    if (it != ranges.begin() && (it - 1)->end >= r.start - (r.start > 0)) // 与前一个相交或相邻
+        --it;
+    auto last = it;
+    while (last != ranges.end() && last->start <= r.end + (r.end < INF)) {
+        r.start = std::min(r.start, last->start);
+        r.end   = std::max(r.end, last->end);
+        ++last;
+    }
+    it = ranges.erase(it, last);
+    ranges.insert(it, r);
+}
+
+bool rangeCovers(const std::vector<rangeDel> &ranges, uint64_t key) {
+    auto it = std::upper_bound(ranges.begin(), ranges.end(), rangeDel(key, key));
+    return it != ranges.begin() && (it - 1)->covers(key);
 }
 
 void skiplist::scan(uint64_t key1, uint64_t key2, std::vector<std::pair<uint64_t, std::string>> &list) {
     slnode *cur1 = lowerBound(key1);
     slnode *cur2 = lowerBound(key2);
     if(cur2->key == key2) {
-        cur2 = cur2->nxt[0];
+        cur2 = cur2->next(0);
     } 
 
     while (cur1 != cur2) {
-        list.push_back(std::make_pair(cur1->key, cur1->val));
-        cur1 = cur1->nxt[0];
+        list.push_back(std::make_pair(cur1->key, cur1->value()));
+        cur1 = cur1->next(0);
     }
 }
 
 slnode* skiplist::lowerBound(uint64_t key) {
     slnode *cur = head;
-    for (int i = curMaxL - 1; i >= 0; --i) {
-        while (cur->nxt[i]->key < key)
-            cur = cur->nxt[i];
+    for (int i = curMaxL.load(std::memory_order_relaxed) - 1; i >= 0; --i) {
+        while (cur->next(i)->key < key)
+            cur = cur->next(i);
+    }
+    return cur->next(0);
+}
+
+slnode *skiplist::lastBefore(uint64_t key) {
+    slnode *cur = head;
+    for (int i = curMaxL.load(std::memory_order_relaxed) - 1; i >= 0; --i) {
+        while (cur->next(i)->key < key)
+            cur = cur->next(i);
     }
-    return cur->nxt[0];
+    return cur;
 }
 
 void skiplist::reset() {
-    slnode *cur = head->nxt[0];
+    version++;
+    slnode *cur = head->next(0);
     while (cur != tail) {
         slnode *tmp = cur;
-        cur = cur->nxt[0];
+        cur = cur->next(0);
         delete tmp;
     }
     for (int i = 0; i < MAX_LEVEL; ++i)
         head->nxt[i] = tail;
     curMaxL = 1;
     bytes = 0;
+    count = 0;
+    ranges = std::make_shared<std::vector<rangeDel>>();
 }
 
 uint32_t skiplist::getBytes() {
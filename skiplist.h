@@ -1,10 +1,14 @@
 #ifndef LSM_KV_SKIPLIST_H
 #define LSM_KV_SKIPLIST_H
 
+#include <atomic>
 #include <cstdint>
 #include <limits>
 #include <list>
+#include <memory>
+#include <mutex>
 #include <string>
+#include <string_view>
 #include <vector>
 
 enum TYPE {
@@ -40,6 +44,41 @@ struct ele {
     }
 };
 
+struct rangeDel { // 范围删除标记，闭区间 [start, end]
+    uint64_t start, end;
+
+    rangeDel(uint64_t s, uint64_t e) : start(s), end(e) {}
+    rangeDel() : start(0), end(0) {}
+
+    bool covers(uint64_t key) const {
+        return start <= key && key <= end;
+    }
+
+    bool operator< (const rangeDel &other) const {
+        return start < other.start;
+    }
+};
+
+struct rangeEle { // 带来源的范围删除，用于 scan 和 compaction 判断新旧
+    uint64_t start, end;
+    uint64_t time;
+    int level;
+
+    rangeEle(const rangeDel &r, uint64_t t, int l) : start(r.start), end(r.end), time(t), level(l) {}
+
+    // 只覆盖比自己旧的数据：层数更小的更新，同一层（level-0）时间戳大的更新
+    bool covers(uint64_t key, uint64_t keyTime, int keyLevel) const {
+        if (key < start || key > end)
+            return false;
+        if (level == keyLevel)
+            return time > keyTime;
+        return level < keyLevel;
+    }
+};
+
+void mergeRange(std::vector<rangeDel> &ranges, rangeDel r); // 插入并合并相交的区间，保持有序
+bool rangeCovers(const std::vector<rangeDel> &ranges, uint64_t key);
+
 struct vecele {
     uint64_t key;
     std::vector<float> vec;
@@ -53,52 +92,153 @@ struct vecele {
 };
 
 
+// 只有写线程修改节点；并发的读者顺着 nxt 走，val 要在 mtx 下复制
 class slnode {
 public:
     uint64_t key;
-    std::string val;
+    std::string val; // 写线程改它时持有 mtx
     TYPE type;
-    std::vector<slnode *> nxt;
+    std::atomic<slnode *> nxt[MAX_LEVEL];
+    mutable std::mutex mtx;
 
     slnode(uint64_t key, const std::string &val, TYPE type) {
         this->key  = key;
         this->val  = val;
         this->type = type;
         for (int i = 0; i < MAX_LEVEL; ++i)
-            nxt.push_back(nullptr);
+            nxt[i].store(nullptr, std::memory_order_relaxed);
+    }
+
+    slnode *next(int i) const {
+        return nxt[i].load(std::memory_order_acquire);
+    }
+
+    void link(int i, slnode *node) { // 发布之前 node 的 nxt 都要填好
+        nxt[i].store(node, std::memory_order_release);
+    }
+
+    std::string value() const {
+        std::lock_guard<std::mutex> lock(mtx);
+        return val;
+    }
+
+    void setValue(const std::string &v) {
+        std::lock_guard<std::mutex> lock(mtx);
+        val = v;
     }
 };
 
+/*
+ * memtable。一个写线程修改，其他线程可以同时读：新节点填好之后才从下往上接进各层，
+ * 节点在跳表销毁之前不会摘下来释放，删除和范围删除都是把值改成删除标记。
+ * 范围删除列表每次修改都换一份新的，读者读的是 shareRanges() 取到的那一份。
+ * getBytes、getCount、getRanges 和 covered 只给写线程用。
+ */
 class skiplist {
 private:
     double p;
     uint32_t bytes = 0x0; // bytes表示index + data区域的字节数
-    int curMaxL    = 1;
+    uint64_t count = 0;   // 节点数，删除标记也算
+    std::atomic<int> curMaxL{1};
     slnode *head   = new slnode(0, "", HEAD);
     slnode *tail   = new slnode(INF, "", TAIL);
+    std::shared_ptr<const std::vector<rangeDel>> ranges; // memtable 中的范围删除，比它们新的点都留在跳表里
+    std::atomic<uint64_t> version{0};                    // 每次修改加一，迭代器据此重新定位，快照据此共用副本
 
 public:
     skiplist(double p) { // p 表示增长概率
         bytes   = 0x0;
         curMaxL = 1;
         this->p = p;
+        ranges  = std::make_shared<std::vector<rangeDel>>();
         for (int i = 0; i < MAX_LEVEL; ++i)
             head->nxt[i] = tail;
     }
 
+    skiplist(const skiplist &other); // 深复制，快照冻结 memtable 用；调用时 other 不能被修改
+    skiplist &operator=(const skiplist &) = delete;
+    ~skiplist();
+
     slnode *getFirst() {
-        return head->nxt[0];
+        return head->next(0);
     }
 
     double my_rand();
     int randLevel();
     void insert(uint64_t key, const std::string &str);
     std::string search(uint64_t key);
+    void searchSorted(const std::vector<uint64_t> &keys, std::vector<std::string> &vals); // keys 升序，没有的 key 为空串
     bool del(uint64_t key);
+    void delRange(uint64_t key1, uint64_t key2); // 区间内的旧节点改成删除标记并记录范围删除
+    bool covered(uint64_t key);
+
+    const std::vector<rangeDel> &getRanges() {
+        return *ranges;
+    }
+
+    std::shared_ptr<const std::vector<rangeDel>> shareRanges() const { // 之后的范围删除不会改动它
+        return ranges;
+    }
+
     void scan(uint64_t key1, uint64_t key2, std::vector<std::pair<uint64_t, std::string>> &list);
     slnode *lowerBound(uint64_t key);
-    void reset();
+    slnode *lastBefore(uint64_t key); // 最后一个 key 比它小的节点，没有时返回头节点
+    void reset(); // 释放所有节点，不能有读者
     uint32_t getBytes();
+
+    uint64_t getCount() const {
+        return count;
+    }
+
+    uint64_t getVersion() const {
+        return version.load(std::memory_order_relaxed);
+    }
+};
+
+// 按 key 顺序遍历 memtable；节点不会被释放，写线程同时修改时可以接着走，
+// 但停下之后前后新插入的节点要重新定位才能看到（stale）
+class memiter {
+private:
+    skiplist *list;
+    slnode *node     = nullptr;
+    uint64_t version = 0; // 定位时跳表的版本
+
+public:
+    explicit memiter(skiplist *list) : list(list) {}
+
+    void seek(uint64_t key) { // 第一个 >= key 的节点
+        version = list->getVersion();
+        node    = list->lowerBound(key);
+    }
+
+    void seekToLast() {
+        version = list->getVersion();
+        node    = list->lastBefore(INF);
+    }
+
+    void next() {
+        node = node->next(0);
+    }
+
+    void prev() { // 单向链表，从头找前驱
+        node = list->lastBefore(node->key);
+    }
+
+    bool stale() const {
+        return version != list->getVersion();
+    }
+
+    bool valid() const {
+        return node && node->type == NORMAL;
+    }
+
+    uint64_t key() const {
+        return node->key;
+    }
+
+    std::string value() const { // 复制一份，写线程可能同时在改
+        return node->value();
+    }
 };
 
 #endif // LSM_KV_SKIPLIST_H
@@ -0,0 +1,41 @@
+#pragma once
+
+#ifndef LSM_KV_SNAPSHOT_H
+#define LSM_KV_SNAPSHOT_H
+
+#include "skiplist.h"
+#include "tableset.h"
+
+#include <cstdint>
+#include <memory>
+#include <set>
+#include <vector>
+
+/*
+ * store 在某个时间点的只读视图，由 KVStore::get_snapshot 创建、release_snapshot 释放。
+ * 它持有一个版本：当时 memtable 的冻结副本加上每层的 sstable，还有 knn 用的向量表。
+ * 之后的写入、flush 和 compaction 都不会改动这些数据：被换掉的 sstable 在快照释放之前保持打开，
+ * 向量表在写入时复制。
+ */
+class Snapshot {
+    friend class KVStore;
+    friend class Iterator;
+
+private:
+    uint64_t seq = 0;                      // 创建时最后一个写入的序号
+    std::shared_ptr<const tableset> view;  // memtable 是冻结的副本，不会再被修改
+    std::shared_ptr<const std::vector<vecele>> vecs;
+    std::set<uint64_t> staleVec; // 当时还没有按 merge 结果重算向量的 key
+
+    Snapshot() = default;
+
+public:
+    Snapshot(const Snapshot &)            = delete;
+    Snapshot &operator=(const Snapshot &) = delete;
+
+    uint64_t getSequence() const { // 在这之前（含）的写入可见，之后的不可见
+        return seq;
+    }
+};
+
+#endif // LSM_KV_SNAPSHOT_H
@@ -1,15 +1,23 @@
 #include "sstable.h"
 
+#include "block.h"
 #include "sstablehead.h"
 #include "utils.h"
 
 #include <iostream>
 const uint32_t MAXSIZE = 2 * 1024 * 1024; // 2MB
 
+// | policy(4) | size(4) | filter(size) |
+static void putFilter(FILE *file, const bloom &filter) {
+    uint32_t meta[2] = {filter.getPolicy(), filter.size()};
+    fwrite(meta, 4, 2, file);
+    fwrite(filter.data(), 1, filter.size(), file);
+}
+
 /*
  *  在path路径下创建一个新的sstable，时间戳为缓存sstable的时间戳
  * */
-void sstable::putFile(const char *path) { // 将内存中的输出到二进制文件中
+void sstable::putFile(const char *path, bool sync, uint64_t version) { // 将内存中的输出到二进制文件中
     // std::cout << "output path" << path << std::endl;
     FILE *file = fopen(path, "wb");
     fseek(file, 0, SEEK_SET);
@@ -18,16 +26,74 @@ void sstable::putFile(const char *path) { // 将内存中的输出到二进制
     fwrite(&cnt, 8, 1, file);
     fwrite(&minV, 8, 1, file);
     fwrite(&maxV, 8, 1, file);
-    for (int i = 0; i < 8 * M; i += 8) { // bloom
-        unsigned char cur = 0x0;
-        for (int j = 0; j < 8; ++j)
-            cur |= (filter.getBit(i + j) << j);
-        fwrite(&cur, 1, 1, file);
+    std::vector<uint64_t> keys(entries.size());
+    for (size_t i = 0; i < entries.size(); ++i)
+        keys[i] = entries[i].key;
+    if (version >= 4) { // 过滤器区带上策略和大小
+        filter.build(keys, bitsPerKey);
+        putFilter(file, filter);
+        if (version >= 5) {
+            rangeBuild(rangeFilter, keys);
+            putFilter(file, rangeFilter);
+        }
+    } else { // 老格式只认固定大小的 bloom
+        filter.reset(FILTER_BLOOM, M);
+        for (uint64_t key : keys)
+            filter.insert(key);
+        fwrite(filter.data(), 1, filter.size(), file);
+    }
+    this->version = version;
+    if (version >= 2)
+        putBlocks(file);
+    else
+        putIndexs(file);
+    fflush(file); // 清空缓冲区
+    if (sync)
+        fsync(fileno(file));
+    fclose(file);
+}
+
+// v2/v3: 数据块、稀疏索引、范围删除区和 footer
+void sstable::putBlocks(FILE *file) {
+    blockbuilder builder;
+    uint32_t pos = ftell(file); // 过滤器之后
+    blocks       = packedindex(pos);
+    for (int i = 0; i < cnt; ++i) {
+        builder.add(entries[i].key, data[i]);
+        if (builder.size() >= DATA_BLOCK_SIZE || i + 1 == cnt) { // 块写满了就切块
+            const std::string &rep = builder.finish();
+            fwrite(rep.data(), 1, rep.size(), file);
+            pos += rep.size();
+            blocks.push(entries[i].key, pos);
+            builder.reset();
+        }
     }
-    int size = index.size();
+    blocks.finish();
+    if (version >= 3) { // 变长编码的稀疏索引
+        const std::string &rep = blocks.encoded();
+        fwrite(rep.data(), 1, rep.size(), file);
+    } else {
+        for (uint32_t p = 0; p < blocks.size(); ++p) {
+            blockIndex b = getBlock(p);
+            fwrite(&b.lastKey, 8, 1, file);
+            fwrite(&b.offset, 4, 1, file);
+            fwrite(&b.size, 4, 1, file);
+        }
+    }
+    for (const rangeDel &r : ranges) {
+        fwrite(&r.start, 8, 1, file);
+        fwrite(&r.end, 8, 1, file);
+    }
+    uint64_t footer[5] = {pos, blocks.size(), ranges.size(), version, SST_MAGIC};
+    fwrite(footer, 8, 5, file);
+}
+
+// v1: 逐 key 索引、values 和可选的范围删除区
+void sstable::putIndexs(FILE *file) {
+    int size = entries.size();
     for (int i = 0; i < size; ++i) { // index
-        uint64_t key    = index[i].key;
-        uint32_t offset = index[i].offset;
+        uint64_t key    = entries[i].key;
+        uint32_t offset = entries[i].offset;
         fwrite(&key, 8, 1, file);
         fwrite(&offset, 4, 1, file);
     }
@@ -35,8 +101,15 @@ void sstable::putFile(const char *path) { // 将内存中的输出到二进制
     for (int i = 0; i < size; ++i) { // datas
         fwrite(data[i].data(), 1, data[i].length(), file);
     }
-    fflush(file); // 清空缓冲区
-    fclose(file);
+    if (!ranges.empty()) { // 范围删除区
+        uint64_t n = ranges.size();
+        for (const rangeDel &r : ranges) {
+            fwrite(&r.start, 8, 1, file);
+            fwrite(&r.end, 8, 1, file);
+        }
+        fwrite(&n, 8, 1, file);
+        fwrite(&RANGE_MAGIC, 8, 1, file);
+    }
 }
 
 char buf[2097152];
@@ -61,54 +134,70 @@ void sstable::loadFile(const char *path) { // load file from the path
     FILE *file = fopen(path, "rb+");
     fseek(file, 0, SEEK_SET); // 移动到开头
     reset();
-    fread(&time, 8, 1, file);
-    fread(&cnt, 8, 1, file);
-    fread(&minV, 8, 1, file);
-    fread(&maxV, 8, 1, file);
-    for (int i = 0; i < 8 * M; i += 8) { // bloom
-        unsigned char cur = 0x0;
-        fread(&cur, 1, 1, file);
-        for (int j = 0; j < 8; ++j) {
-            if ((cur >> j) & 1)
-                filter.setBit(i + j);
+    loadHeader(file);
+    bool isBlock = loadFooter(file);
+    loadFilter(file);
+    if (isBlock)
+        loadBlocks(file);
+    else
+        loadIndexs(file);
+    fflush(file);
+    fclose(file);
+}
+
+void sstable::loadBlocks(FILE *file) { // v2/v3: 解开每个数据块
+    std::string rep;
+    for (uint32_t p = 0; p < blocks.size(); ++p) {
+        blockIndex b = getBlock(p);
+        rep.resize(b.size);
+        fseek(file, b.offset, SEEK_SET);
+        fread(&rep[0], 1, b.size, file);
+        blockiter it(rep);
+        for (it.seekToFirst(); it.valid(); it.next()) {
+            std::string val = it.value();
+            curpos += val.length();
+            entries.emplace_back(it.key(), curpos);
+            data.push_back(std::move(val));
         }
     }
-    bytes = 10240 + 32 + 12 * cnt;
-    Index temp;
+}
+
+void sstable::loadIndexs(FILE *file) { // v1
+    bytes = 32 + filter.size() + 12 * cnt;
+    Index temp(0, 0);
     for (int i = 0; i < cnt; ++i) { // index
         fread(&temp.key, 8, 1, file);
         fread(&temp.offset, 4, 1, file);
-        index.push_back(temp);
+        entries.push_back(temp);
     }
     bytes += temp.offset;
+    loadRanges(file);
     std::string cur; // data
-    fread(buf, 1, index[0].offset, file);
-    buf[index[0].offset] = '\0';
-    cur                  = buf;
-    data.push_back(cur);
+    if (cnt) {
+        fread(buf, 1, entries[0].offset, file);
+        buf[entries[0].offset] = '\0';
+        cur                  = buf;
+        data.push_back(cur);
+    }
     for (int i = 1; i < cnt; ++i) {
-        fread(buf, 1, index[i].offset - index[i - 1].offset, file);
-        buf[index[i].offset - index[i - 1].offset] = '\0';
-        cur                                        = buf;
+        fread(buf, 1, entries[i].offset - entries[i - 1].offset, file);
+        buf[entries[i].offset - entries[i - 1].offset] = '\0';
+        cur                                            = buf;
         data.push_back(cur);
     }
-    fflush(file);
-    fclose(file);
 }
 
 bloom sstable::copyFilter() {
-    bloom *res = new bloom;
-    res->setBitset(filter.getBitset());
-    return *res;
+    return filter;
 }
 
 std::vector<Index> sstable::copyIndexs() {
-    std::vector<Index> *res = new std::vector<Index>(index);
+    std::vector<Index> *res = new std::vector<Index>(entries);
     return *res;
 }
 
-sstablehead sstable::getHead() {
-    auto *res = new sstablehead;
+std::shared_ptr<sstablehead> sstable::getHead() const {
+    auto res = std::make_shared<sstablehead>();
     res->setFilename(filename);
     res->setNamesuffix(nameSuffix);
     res->setTime(time);
@@ -117,31 +206,56 @@ sstablehead sstable::getHead() {
     res->setMaxV(maxV);
     res->setBytes(bytes);
     res->setFilter(filter);
-    res->setIndex(index);
-    return *res;
+    res->setRangeFilter(rangeFilter);
+    res->setVersion(version);
+    if (version >= 2)
+        res->setBlocks(blocks); // 块格式只需要稀疏索引
+    else {
+        packedindex packed;
+        for (const Index &e : entries)
+            packed.push(e.key, e.offset);
+        packed.finish();
+        res->setIndex(packed);
+    }
+    res->setRanges(ranges);
+    return res;
 }
 
 // 向sstable尾部插一个key-val对，同时修改头和bloom filter
 void sstable::insert(uint64_t key, const std::string &val) {
+    prefixes += cnt ? rangePrefixes(entries.back().key, key) : RANGE_LEVELS;
     cnt++;
     curpos += val.length();
     minV = std::min(minV, key);
     maxV = std::max(maxV, key);
-    bytes += 12 + val.length();
-    index.emplace_back(key, curpos);
-    filter.insert(key);
+    body += 12 + val.length();
+    resize();
+    entries.emplace_back(key, curpos);
     data.push_back(val);
 }
 
-void sstable::addNewSst(int curLevel) {
+void sstable::addRange(const rangeDel &r) {
+    minV = std::min(minV, r.start);
+    maxV = std::max(maxV, r.end);
+    body += 16;
+    resize();
+    ranges.push_back(r);
+}
+
+void sstable::addNewSst(int curLevel, bool sync) {
     std::string url = std::string("./data/level-") + std::to_string(curLevel) + "/";
     url += std::to_string(time) + "-" + std::to_string(++nameSuffix) + ".sst";
     filename = url;
-    putFile(url.data());
+    putFile(url.data(), sync);
+}
+
+uint32_t sstable::headBytes(uint64_t keys, uint64_t prefixes, filterPolicy policy, double bitsPerKey) {
+    return 32 + 8 + bloom::sizeFor(policy, keys, bitsPerKey) + 8 + rangeBytes(prefixes); // 和 SST_VERSION 的布局一致
 }
 
-bool sstable::checkSize(std::string val, int curLevel) {
-    uint32_t nxtBytes = bytes + 12 + val.length();
+bool sstable::checkSize(std::string val, int curLevel) { // 下一个 key 的前缀按全是新的算
+    uint32_t nxtBytes =
+        body + 12 + val.length() + headBytes(cnt + 1, prefixes + RANGE_LEVELS, filter.getPolicy(), bitsPerKey);
     if (nxtBytes > MAXSIZE) {
         return true;
     }
@@ -14,35 +14,60 @@ static uint64_t TIME = 0;                     // 全局时间戳
 class sstable : public sstablehead { // 储存sstable的软数据结构
 private:
     std::vector<std::string> data;
+    std::vector<Index> entries; // 构建时的逐 key 索引，写出或取头部时再压缩
+    double bitsPerKey = BITS_PER_KEY; // 写出时按 key 数决定过滤器大小
+    uint32_t body     = 0;            // 索引、数据和范围删除区的字节数
+    uint64_t prefixes = 0;            // 范围过滤器的前缀数，key 按序插入时逐个数
+
+    void resize() { // 表头和过滤器区跟着 key 数变
+        bytes = body + headBytes(cnt, prefixes, filter.getPolicy(), bitsPerKey);
+    }
+
+    void putBlocks(FILE *file);
+    void putIndexs(FILE *file);
+    void loadBlocks(FILE *file);
+    void loadIndexs(FILE *file);
 
 public:
     void reset() { // 这里不reset time, namesuf
-        cnt    = 0;
-        curpos = 0;
-        minV   = INF;
-        maxV   = 0;
-        bytes  = 10240 + 32;
+        cnt      = 0;
+        curpos   = 0;
+        minV     = INF;
+        maxV     = 0;
+        body     = 0;
+        prefixes = 0;
+        resize();
         filter.reset();
+        rangeFilter.reset(FILTER_BLOCKED, 0);
         index.clear();
+        blocks.clear();
+        ranges.clear();
         data.clear();
+        entries.clear();
     }
 
-    sstable() {
+    explicit sstable(filterPolicy policy = FILTER_BLOOM, double bitsPerKey = BITS_PER_KEY) {
+        filter.reset(policy, 0);
+        this->bitsPerKey = bitsPerKey;
         time   = 0;
         cnt    = 0;
         curpos = 0;
         minV   = INF;
         maxV   = 0;
-        bytes  = 10240 + 32;
+        resize();
         filter.reset();
         index.clear();
         data.clear();
+        entries.clear();
     }
 
-    sstable(skiplist *s) { // 将一个memtable转成sstable， 这里时间戳加1
+    sstable(skiplist *s, filterPolicy policy = FILTER_BLOOM,
+            double bitsPerKey = BITS_PER_KEY) { // 将一个memtable转成sstable， 这里时间戳加1
         reset();
+        filter.reset(policy, 0);
+        this->bitsPerKey = bitsPerKey;
         curpos      = 0;
-        bytes       = 10240 + 32 + s->getBytes();
+        body        = s->getBytes();
         time        = ++TIME;
         filename    = "./data/level-0/" + std::to_string(TIME) + ".sst"; // 初始的文件名就是时间戳
         cnt         = 0;
@@ -50,19 +75,28 @@ public:
         maxV        = 0;
         slnode *cur = s->getFirst();
         while (cur->type != TAIL) { // curpos 为这个串的终止地址
+            prefixes += cnt ? rangePrefixes(entries.back().key, cur->key) : RANGE_LEVELS;
             cnt++;
             curpos += cur->val.length();
             minV = std::min(minV, cur->key);
             maxV = std::max(maxV, cur->key);
-            filter.insert(cur->key);
-            index.emplace_back(cur->key, curpos);
+            entries.emplace_back(cur->key, curpos);
             data.push_back(cur->val);
-            cur = cur->nxt[0];
+            cur = cur->next(0);
         }
+        ranges = s->getRanges(); // memtable 里的点都比它的范围删除新，字节数已经算在 s->getBytes() 里
+        for (const rangeDel &r : ranges) {
+            minV = std::min(minV, r.start);
+            maxV = std::max(maxV, r.end);
+        }
+        resize();
     }
 
-    sstable(int level) { // 将一个eleArr转成数个sstable
+    sstable(int level, filterPolicy policy = FILTER_BLOOM,
+            double bitsPerKey = BITS_PER_KEY) { // 将一个eleArr转成数个sstable
         reset();
+        filter.reset(policy, 0);
+        this->bitsPerKey = bitsPerKey;
         curpos      = 0;
         time        = ++TIME;
         filename    = "./data/level-" + std::to_string(level) + "/" + std::to_string(TIME) + ".sst"; 
@@ -71,21 +105,34 @@ public:
         maxV        = 0;
     }
 
+    static uint32_t headBytes(uint64_t keys, uint64_t prefixes, filterPolicy policy,
+                              double bitsPerKey); // 表头和过滤器区的字节数，prefixes 是范围过滤器的前缀数
+
     bool checkSize(std::string val, int curLevel);        // 检查大小，如果不够加val, 返回true
-    void addNewSst(int curLevel);
-    void putFile(const char *path);  //  将sstable输出到路径
-    void loadFile(const char *path); // 从路径载入一个sstable
+    void addNewSst(int curLevel, bool sync = false);      // 写出合并的一个输出文件，sync 时等待落盘
+    void putFile(const char *path, bool sync = false,
+                 uint64_t version = SST_VERSION); //  将sstable输出到路径, sync 时等待落盘，过滤器在这里建
+    void loadFile(const char *path); // 从路径载入一个sstable，两种格式都可以
 
     void insert(uint64_t key, const std::string &val);
+    void addRange(const rangeDel &r); // 追加一个范围删除，要求按 start 有序且互不相交
+
+    bool empty() const {
+        return !cnt && ranges.empty();
+    }
 
     bloom copyFilter();
     std::vector<Index> copyIndexs();
 
+    uint64_t getKey(int p) const {
+        return entries[p].key;
+    }
+
     std::string getData(int p) {
         return data[p];
     }
 
-    sstablehead getHead(); // 取出头部
+    std::shared_ptr<sstablehead> getHead() const; // 取出头部
 };
 
 #endif // LSM_KV_SSTABLE_H
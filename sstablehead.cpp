@@ -1,5 +1,6 @@
 #include "sstablehead.h"
 
+#include <algorithm>
 #include <cstring>
 #include <iostream>
 
@@ -24,67 +25,181 @@ void sstablehead::loadFileHead(const char *path) { // 只读取文件头
     fseek(file, 0, SEEK_SET);
     reset();
 
+    loadHeader(file);
+    bool isBlock = loadFooter(file);
+    loadFilter(file);
+    if (!isBlock) { // v1
+        Index temp(0, 0);
+        bytes = 10240 + 32 + 12 * cnt;
+        for (int i = 0; i < cnt; ++i) { // index
+            fread(&temp.key, 8, 1, file);
+            fread(&temp.offset, 4, 1, file);
+            index.push(temp.key, temp.offset);
+        }
+        index.finish();
+        bytes += temp.offset;
+        loadRanges(file);
+    }
+    fflush(file);
+    fclose(file);
+}
+
+void sstablehead::loadHeader(FILE *file) {
     fread(&time, 8, 1, file);
     fread(&cnt, 8, 1, file);
     fread(&minV, 8, 1, file);
     fread(&maxV, 8, 1, file);
-    for (int i = 0; i < M * 8; i += 8) { // bloom
-        unsigned char cur = 0x0;
-        fread(&cur, 1, 1, file);
-        for (int j = 0; j < 8; ++j) {
-            if ((cur >> j) & 1)
-                filter.setBit(i + j);
+}
+
+// 读一个 | policy(4) | size(4) | filter(size) | 的过滤器区
+static void readFilter(FILE *file, bloom &filter, const std::string &filename) {
+    uint32_t meta[2] = {0, 0};
+    fread(meta, 4, 2, file);
+    if (meta[0] > FILTER_XOR8 || meta[1] % FILTER_BLOCK) {
+        std::cerr << "Error: unsupported filter " << meta[0] << " of size " << meta[1] << " in " << filename
+                  << std::endl;
+        fseek(file, meta[1], SEEK_CUR);
+        filter.reset(FILTER_BLOOM, 0); // 没有过滤器，所有查询都去读数据
+        return;
+    }
+    filter.reset((filterPolicy)meta[0], meta[1]);
+    fread(filter.data(), 1, filter.size(), file);
+}
+
+void sstablehead::loadFilter(FILE *file) {
+    if (version < 4) { // 固定 10240 字节的 bloom
+        filter.reset(FILTER_BLOOM, M);
+        fread(filter.data(), 1, filter.size(), file);
+        return;
+    }
+    readFilter(file, filter, filename);
+    if (version >= 5)
+        readFilter(file, rangeFilter, filename);
+}
+
+bool sstablehead::loadFooter(FILE *file) {
+    long pos = ftell(file);
+    uint64_t footer[5] = {0}; // indexOffset, nBlocks, nRanges, version, magic
+    if (fseek(file, -(long)FOOTER_SIZE, SEEK_END) != 0 || fread(footer, 8, 5, file) != 5 || footer[4] != SST_MAGIC) {
+        fseek(file, pos, SEEK_SET);
+        return false;
+    }
+    version = footer[3];
+    long rangePos = ftell(file) - FOOTER_SIZE - 16 * footer[2];
+    uint32_t dataStart = 10240 + 32;
+    if (version >= 4) { // 数据块紧跟在过滤器区后面，v5 有两个过滤器区
+        dataStart = 32;
+        for (int i = 0; i < (version >= 5 ? 2 : 1); ++i) {
+            uint32_t meta[2] = {0, 0};
+            fseek(file, dataStart, SEEK_SET);
+            fread(meta, 4, 2, file);
+            dataStart += 8 + meta[1];
         }
     }
-    Index temp;
-    bytes = 10240 + 32 + 12 * cnt;
-    for (int i = 0; i < cnt; ++i) { // index
-        fread(&temp.key, 8, 1, file);
-        fread(&temp.offset, 4, 1, file);
-        index.push_back(temp);
+    blocks = packedindex(dataStart);
+    fseek(file, footer[0], SEEK_SET);
+    if (version >= 3) { // 变长编码，长度由范围删除区的位置决定
+        std::string rep(rangePos - footer[0], '\0');
+        fread(&rep[0], 1, rep.size(), file);
+        if (!blocks.load(rep, footer[1]))
+            std::cerr << "Error: corrupted block index in " << filename << std::endl;
+    } else {
+        blockIndex b;
+        for (uint64_t i = 0; i < footer[1]; ++i) {
+            fread(&b.lastKey, 8, 1, file);
+            fread(&b.offset, 4, 1, file);
+            fread(&b.size, 4, 1, file);
+            blocks.push(b.lastKey, b.offset + b.size);
+        }
+        blocks.finish();
     }
-    bytes += temp.offset;
-    fflush(file);
-    fclose(file);
+    fseek(file, rangePos, SEEK_SET);
+    for (uint64_t i = 0; i < footer[2]; ++i) {
+        rangeDel r;
+        fread(&r.start, 8, 1, file);
+        fread(&r.end, 8, 1, file);
+        ranges.push_back(r);
+    }
+    bytes = ftell(file) + FOOTER_SIZE; // 文件大小
+    fseek(file, pos, SEEK_SET);
+    return true;
+}
+
+/*
+ * 范围删除区位于文件末尾: | {start(8) | end(8)} * n | n(8) | RANGE_MAGIC(8) |
+ */
+void sstablehead::loadRanges(FILE *file) {
+    long pos = ftell(file);
+    uint64_t n = 0, magic = 0;
+    if (fseek(file, -16, SEEK_END) == 0) {
+        fread(&n, 8, 1, file);
+        fread(&magic, 8, 1, file);
+    }
+    if (magic == RANGE_MAGIC && fseek(file, -16 - 16 * (long)n, SEEK_END) == 0) {
+        for (uint64_t i = 0; i < n; ++i) {
+            rangeDel r;
+            fread(&r.start, 8, 1, file);
+            fread(&r.end, 8, 1, file);
+            ranges.push_back(r);
+        }
+        bytes += 16 * n + 16;
+    }
+    fseek(file, pos, SEEK_SET);
 }
 
 void sstablehead::reset() {
     filter.reset();
+    rangeFilter.reset(FILTER_BLOCKED, 0);
+    version = 1;
     index.clear();
+    blocks.clear();
+    ranges.clear();
+}
+
+bool sstablehead::mayOverlap(uint64_t lo, uint64_t hi) const {
+    lo = std::max(lo, minV);
+    hi = std::min(hi, maxV);
+    if (lo > hi)
+        return false;
+    if (hi - lo < RANGE_PROBES) { // 很短的区间直接逐个查点过滤器
+        for (uint64_t key = lo;; ++key) { // hi 可能是 INF，不能用 key <= hi 结束
+            if (filter.search(key))
+                return true;
+            if (key == hi)
+                return false;
+        }
+    }
+    return rangeMayOverlap(rangeFilter, lo, hi);
+}
+
+int sstablehead::findBlock(uint64_t key) const {
+    return blocks.lowerBound(key); // 第一个 lastKey >= key 的块
 }
 
-int sstablehead::search(uint64_t key) {
+int sstablehead::search(uint64_t key) const {
     int res = filter.search(key);
     if (!res)
         return -1; // bloom 说没有 确实没有
-    auto it = std::lower_bound(index.begin(), index.end(), Index(key, 0));
-    if (it == index.end())
+    int p = index.lowerBound(key);
+    if (p == (int)index.size())
         return -1; // 没找到
-    if ((*it).key == key)
-        return it - index.begin(); // 在这一块二分找到了，返回第几个字符串
+    if (index.at(p).key == key)
+        return p; // 在这一块二分找到了，返回第几个字符串
     return -1;
 }
 
-int sstablehead::searchOffset(uint64_t key, uint32_t &len) {
-    int res = filter.search(key);
-    if (!res)
-        return -1; // bloom 说没有 确实没有
-    auto it = std::lower_bound(index.begin(), index.end(), Index(key, 0));
-    if (it == index.end())
+int sstablehead::searchOffset(uint64_t key, uint32_t &len) const {
+    int p = index.lowerBound(key);
+    if (p == (int)index.size())
         return -1; // 没找到
-    if ((*it).key == key) {
-        if (it == index.begin()) {
-            len = (*it).offset;
-            return 0;
-        } else {
-            len = (*it).offset - (*(it - 1)).offset;
-            return (*(it - 1)).offset;
-        }
-    }
-    return -1;
+    uint32_t start;
+    Index it = index.at(p, &start);
+    if (it.key != key)
+        return -1;
+    len = it.offset - start;
+    return start;
 }
 
-int sstablehead::lowerBound(uint64_t key) {
-    auto it = std::lower_bound(index.begin(), index.end(), Index(key, 0));
-    return it - index.begin(); // found
+int sstablehead::lowerBound(uint64_t key) const {
+    return index.lowerBound(key); // found
 }
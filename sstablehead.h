@@ -3,27 +3,44 @@
 #ifndef LSM_KV_SSTABLEHEAD_H
 #define LSM_KV_SSTABLEHEAD_H
 #include "bloom.h"
+#include "packedindex.h"
+#include "rangefilter.h"
+#include "skiplist.h"
 
 #include <cstdint>
-#include <vector>
+#include <cstdio>
 #include <limits>
+#include <memory>
+#include <string>
+#include <vector>
 
-struct Index {
-    uint64_t key;
-    uint32_t offset;
+const uint64_t RANGE_MAGIC = 0x4c454445474e4152; // "RANGEDEL", 文件末尾有范围删除区时的标记
+const uint64_t SST_MAGIC   = 0x3256454c42415453; // "STABLEV2", 块格式 sstable 的文件尾标记
+const uint64_t SST_VERSION = 5;                  // 新写入的 sstable 格式
+const uint32_t FOOTER_SIZE = 40;
 
-    Index() {}
+struct blockIndex { // 块格式的稀疏索引，每个数据块一项
+    uint64_t lastKey;
+    uint32_t offset, size; // 数据块在文件中的位置
 
-    Index(uint64_t key, uint32_t offset) {
-        this->key    = key;
-        this->offset = offset;
-    }
+    blockIndex() {}
 
-    bool operator<(const Index &b) const {
-        return this->key < b.key;
-    }
+    blockIndex(uint64_t lastKey, uint32_t offset, uint32_t size) : lastKey(lastKey), offset(offset), size(size) {}
 };
 
+/*
+ * sstable 文件格式：
+ * v1: | header(32) | bloom(10240) | {key(8) | offset(4)} * cnt | values | 范围删除区(可选) |
+ * v2: | header(32) | bloom(10240) | 数据块 | {lastKey(8) | offset(4) | size(4)} * nBlocks |
+ *     | {start(8) | end(8)} * nRanges | footer |
+ * v3: 同 v2，但稀疏索引是 packedindex 的编码 | {lastKeyDelta(varint) | size(varint)} * nBlocks |
+ * v4: 同 v3，但 bloom 换成带策略和大小的过滤器区 | policy(4) | size(4) | filter(size) |，数据块紧跟其后；
+ *     size 按表里的 key 数和每个 key 的位数决定；policy 见 filterPolicy
+ * v5: 同 v4，过滤器区之后再跟一个同样布局的范围过滤器区（见 rangefilter.h），然后才是数据块
+ * footer: | indexOffset(8) | nBlocks(8) | nRanges(8) | version(8) | SST_MAGIC(8) |
+ * v1 在内存里保存每个 key 的索引，v2/v3 只保存每个数据块的最后一个 key，都用 packedindex 压缩。
+ */
+
 class sstablehead {
 protected:
     std::string filename; // filename表示该sstable的名字，含路径前缀和后缀
@@ -31,8 +48,18 @@ protected:
     uint32_t bytes;          // 理论上的sstable转换成文件的大小
     uint32_t curpos;         // 当前offset的位置
     uint32_t nameSuffix = 0; // 区分同一时间戳，不同文件的姓名后缀
+    uint64_t fileId     = 0; // 进程内唯一的文件编号，块缓存用它区分文件
     bloom filter;
-    std::vector<Index> index;
+    bloom rangeFilter; // v5 的前缀过滤器，scan 用它跳过区间内没有 key 的表
+    uint64_t version = 1;
+    packedindex index;                        // v1 的逐 key 索引，offset 为 value 的累计结束位置
+    packedindex blocks = packedindex(10240 + 32); // 块格式的稀疏索引，offset 为数据块的结束位置
+    std::vector<rangeDel> ranges; // 范围删除，有序且互不相交；minV/maxV 也包含它们的端点
+
+    void loadHeader(FILE *file);  // 读取 header
+    void loadFilter(FILE *file);  // 紧接 header 读取过滤器，要先 loadFooter 知道版本
+    void loadRanges(FILE *file);  // 读取 v1 文件末尾的范围删除区（旧文件没有）
+    bool loadFooter(FILE *file);  // 是块格式文件时读取稀疏索引和范围删除区
 
 public:
     bool operator<(const sstablehead &other) const {
@@ -61,6 +88,10 @@ public:
         this->nameSuffix = nameSuffix;
     }
 
+    void setFileId(uint64_t fileId) {
+        this->fileId = fileId;
+    }
+
     void setTime(uint64_t time) {
         this->time = time;
     }
@@ -81,18 +112,76 @@ public:
         this->bytes = bytes;
     }
 
-    void setFilter(bloom filter) {
-        this->filter.setBitset(filter.getBitset());
+    void setFilter(const bloom &filter) {
+        this->filter = filter;
     }
 
-    void setIndex(std::vector<Index> index) {
+    void setRangeFilter(const bloom &rangeFilter) {
+        this->rangeFilter = rangeFilter;
+    }
+
+    void setIndex(const packedindex &index) {
         this->index = index;
     } // 使用深复制
 
-    std::string getFilename() {
+    void setBlocks(const packedindex &blocks) {
+        this->blocks = blocks;
+    }
+
+    void setVersion(uint64_t version) {
+        this->version = version;
+    }
+
+    uint64_t getVersion() const {
+        return version;
+    }
+
+    size_t getBlockCnt() const {
+        return blocks.size();
+    }
+
+    blockIndex getBlock(int p) const {
+        uint32_t start;
+        Index b = blocks.at(p, &start);
+        return blockIndex(b.key, start, b.offset - start);
+    }
+
+    int findBlock(uint64_t key) const; // 可能包含 key 的数据块，没有返回 getBlockCnt()
+
+    size_t indexBytes() const { // 索引占用的内存
+        return index.bytes() + blocks.bytes();
+    }
+
+    bool mayContain(const keyHash &h) const { // h 由 bloom::hash 算出，一次查询所有表共用
+        return filter.mayContain(h);
+    }
+
+    void prefetchFilter(const keyHash &h) const {
+        filter.prefetch(h);
+    }
+
+    bool mayOverlap(uint64_t lo, uint64_t hi) const; // false 表示 [lo, hi] 里肯定没有点（不管范围删除）
+
+    void setRanges(const std::vector<rangeDel> &ranges) {
+        this->ranges = ranges;
+    }
+
+    const std::vector<rangeDel> &getRanges() const {
+        return ranges;
+    }
+
+    bool covered(uint64_t key) const { // key 是否被本表的范围删除覆盖
+        return !ranges.empty() && rangeCovers(ranges, key);
+    }
+
+    const std::string &getFilename() const {
         return filename;
     }
 
+    uint64_t getFileId() const {
+        return fileId;
+    }
+
     uint64_t getTime() const {
         return time;
     }
@@ -109,8 +198,8 @@ public:
         return maxV;
     }
 
-    uint64_t getKey(int p) {
-        return index[p].key;
+    uint64_t getKey(int p) const {
+        return index.at(p).key;
     }
 
     uint32_t getBytes() const {
@@ -121,19 +210,33 @@ public:
         return nameSuffix;
     }
 
-    uint32_t getOffset(int p) {
-        return (p < 0) ? 0 : index[p].offset;
+    uint32_t getOffset(int p) const {
+        return (p < 0) ? 0 : index.at(p).offset;
     }
 
-    Index getIndexById(int p) {
-        return index[p];
+    uint32_t getDataStart() const { // 数据区在文件中的起始位置
+        return 10240 + 32 + 12 * cnt;
     }
 
-    int searchOffset(uint64_t key, uint32_t &len);
+    uint32_t getDataEnd() const {
+        return getDataStart() + getOffset(cnt - 1);
+    }
+
+    Index getIndexById(int p) const {
+        return index.at(p);
+    }
 
-    int search(uint64_t key);
-    int lowerBound(uint64_t key); /*返回大于等于的第一个的下标 没有返回len + 1*/
-    void showIndexs();
+    int searchOffset(uint64_t key, uint32_t &len) const; // 不查过滤器，调用方先用 mayContain
+
+    int search(uint64_t key) const;
+    int lowerBound(uint64_t key) const; /*返回大于等于的第一个的下标 没有返回len + 1*/
+    void showIndexs() const;
 };
 
+/*
+ * 加入 sstableIndex 之后表头不再修改，读路径和 compaction 共享同一份。
+ * compaction 把它移出 sstableIndex 后，还在使用它的读者持有引用，不会失效。
+ */
+typedef std::shared_ptr<const sstablehead> tableHandle;
+
 #endif // LSM_KV_SSTABLEHEAD_H
@@ -0,0 +1,110 @@
+#include "tablecache.h"
+
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <iostream>
+#include <unistd.h>
+
+tablecache::~tablecache() {
+    clear();
+}
+
+int tablecache::open(const std::string &file) {
+    auto it = files.find(file);
+    if (it != files.end()) {
+        lru.splice(lru.begin(), lru, it->second.pos); // 移到表头
+        return it->second.fd;
+    }
+
+    int fd = ::open(file.data(), O_RDONLY);
+    if (fd < 0) {
+        std::cerr << "Error: Unable to open file " << file << ": " << strerror(errno) << std::endl;
+        return -1;
+    }
+    // 关闭最久没用、没有被固定的文件
+    for (auto v = lru.rbegin(); files.size() >= capacity && v != lru.rend(); ++v) {
+        auto victim = files.find(*v);
+        if (victim->second.pins)
+            continue;
+        ::close(victim->second.fd);
+        files.erase(victim);
+        lru.erase(std::next(v).base());
+        break;
+    }
+    lru.push_front(file);
+    files[file] = handle{fd, lru.begin()};
+    return fd;
+}
+
+bool tablecache::read(const std::string &file, uint64_t offset, uint32_t len, char *buf) {
+    int fd = pin(file); // 读的时候不持有锁，大块的顺序读不会挡住别的线程
+    if (fd < 0)
+        return false;
+    uint32_t done = 0;
+    while (done < len) { // pread 可能只读了一部分
+        ssize_t n = ::pread(fd, buf + done, len - done, offset + done);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0) {
+            std::cerr << "Error: Unable to read file " << file << std::endl;
+            break;
+        }
+        done += n;
+    }
+    unpin(file);
+    return done == len;
+}
+
+void tablecache::prefetch(const std::string &file, uint64_t offset, uint64_t len) {
+    int fd = pin(file);
+    if (fd < 0)
+        return;
+    posix_fadvise(fd, offset, len, POSIX_FADV_WILLNEED);
+    unpin(file);
+}
+
+int tablecache::pin(const std::string &file) {
+    std::lock_guard<std::mutex> lock(mtx);
+    int fd = open(file);
+    if (fd >= 0)
+        files[file].pins++;
+    return fd;
+}
+
+void tablecache::unpin(const std::string &file) {
+    std::lock_guard<std::mutex> lock(mtx);
+    auto it = files.find(file);
+    if (it == files.end() || --it->second.pins || !it->second.stale)
+        return;
+    ::close(it->second.fd);
+    lru.erase(it->second.pos);
+    files.erase(it);
+}
+
+void tablecache::evict(const std::string &file) {
+    std::lock_guard<std::mutex> lock(mtx);
+    auto it = files.find(file);
+    if (it == files.end())
+        return;
+    if (it->second.pins) { // 等在途的读完成
+        it->second.stale = true;
+        return;
+    }
+    ::close(it->second.fd);
+    lru.erase(it->second.pos);
+    files.erase(it);
+}
+
+void tablecache::clear() {
+    std::lock_guard<std::mutex> lock(mtx);
+    for (auto &f : files)
+        ::close(f.second.fd);
+    files.clear();
+    lru.clear();
+}
+
+size_t tablecache::size() {
+    std::lock_guard<std::mutex> lock(mtx);
+    return files.size();
+}
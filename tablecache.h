@@ -0,0 +1,49 @@
+#pragma once
+
+#ifndef LSM_KV_TABLECACHE_H
+#define LSM_KV_TABLECACHE_H
+
+#include <cstdint>
+#include <list>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+const size_t TABLE_CACHE_SIZE = 64; // 最多同时打开的 sstable 文件数
+
+/*
+ * sstable 文件描述符缓存。读 value 时复用已经打开的 fd，用 pread 直接读到结果里，
+ * 不再每次 fopen / fseek / fread / fclose。超过容量时关闭最久没用的文件。
+ * sstable 写完之后不再修改，所以缓存的 fd 一直有效，直到文件被删除。
+ */
+class tablecache {
+private:
+    struct handle {
+        int fd;
+        std::list<std::string>::iterator pos; // 在 lru 中的位置
+        int pins   = 0;                       // 异步读还在用，不能关闭
+        bool stale = false;                   // 文件已经删除，最后一个 unpin 时关闭
+    };
+
+    size_t capacity;
+    std::list<std::string> lru; // 表头是最近使用的文件
+    std::unordered_map<std::string, handle> files;
+    std::mutex mtx;
+
+    int open(const std::string &file); // 调用者持有 mtx，返回 -1 表示打开失败
+
+public:
+    tablecache(size_t capacity = TABLE_CACHE_SIZE) : capacity(capacity) {}
+    ~tablecache();
+
+    bool read(const std::string &file, uint64_t offset, uint32_t len, char *buf); // 读满 len 字节才返回 true
+    void prefetch(const std::string &file, uint64_t offset, uint64_t len); // 让内核在后台把这段读进页缓存
+    int pin(const std::string &file);   // 返回的 fd 在 unpin 之前不会被关闭，失败返回 -1
+    void unpin(const std::string &file);
+    void evict(const std::string &file); // 文件被删除前关闭它
+    void clear();
+
+    size_t size();
+};
+
+#endif // LSM_KV_TABLECACHE_H
@@ -0,0 +1,163 @@
+#include "tableiter.h"
+
+#include "kvstore.h"
+
+#include <algorithm>
+
+tableiter::tableiter(KVStore *store, const tableHandle &table) : store(store), table(table) {}
+
+bool tableiter::loadBlock(const blockHandle &loaded) {
+    iter.reset();
+    if (pos < 0 || pos >= (int)table->getBlockCnt())
+        return false;
+    blockIndex b = table->getBlock(pos);
+    block        = loaded ? loaded : store->blockCache.lookup(table->getFileId(), b.offset);
+    std::string_view view;
+    if (!block && readAhead(b.offset, b.size, view)) { // 直接在预读缓冲上遍历，不复制
+        ra.next = b.offset + b.size;
+        iter.emplace(view);
+        return true;
+    }
+    if (!block)
+        block = store->readBlock(*table, b);
+    ra.next = b.offset + b.size;
+    if (!block)
+        return false;
+    iter.emplace(*block);
+    return true;
+}
+
+void tableiter::seek(uint64_t key, const blockHandle &loaded) {
+    if (table->getVersion() < 2) {
+        pos = table->lowerBound(key);
+        return;
+    }
+    pos = table->findBlock(key);
+    if (loadBlock(loaded))
+        iter->seek(key);
+}
+
+void tableiter::seekToFirst() {
+    pos = 0;
+    if (table->getVersion() >= 2 && loadBlock())
+        iter->seekToFirst();
+}
+
+void tableiter::seekToLast() {
+    if (table->getVersion() < 2) {
+        pos = (int)table->getCnt() - 1;
+        return;
+    }
+    pos = (int)table->getBlockCnt() - 1;
+    if (loadBlock())
+        iter->seekToLast();
+}
+
+void tableiter::next() {
+    if (table->getVersion() < 2) {
+        pos++;
+        return;
+    }
+    iter->next();
+    if (!iter->valid()) { // 进入下一个数据块
+        pos++;
+        if (loadBlock())
+            iter->seekToFirst();
+    }
+}
+
+void tableiter::prev() {
+    if (table->getVersion() < 2) {
+        pos--;
+        return;
+    }
+    iter->prev();
+    if (!iter->valid()) { // 回到上一个数据块
+        pos--;
+        if (loadBlock())
+            iter->seekToLast();
+    }
+}
+
+bool tableiter::valid() const {
+    if (table->getVersion() < 2)
+        return pos >= 0 && pos < (int)table->getCnt();
+    return iter && iter->valid();
+}
+
+uint64_t tableiter::key() const {
+    if (table->getVersion() < 2)
+        return table->getKey(pos);
+    return iter->key();
+}
+
+std::string tableiter::value() const {
+    if (table->getVersion() < 2) {
+        uint32_t start  = table->getOffset(pos - 1);
+        uint32_t len    = table->getOffset(pos) - start;
+        uint64_t offset = table->getDataStart() + start;
+        std::string_view view;
+        std::string res = readAhead(offset, len, view) ? std::string(view) : store->fetchString(*table, offset, len);
+        ra.next         = offset + len;
+        return res;
+    }
+    return iter->value();
+}
+
+std::string_view tableiter::valueView(std::string &scratch) const {
+    if (table->getVersion() < 2) {
+        scratch = value();
+        return scratch;
+    }
+    return iter->valueView();
+}
+
+/**
+ * Serve [offset, offset + len) from the readahead buffer when the reads
+ * are sequential. The first read right after the previous one (small
+ * gaps allowed once readahead is on) starts a READAHEAD_MIN window, and
+ * every refill doubles it up to READAHEAD_MAX. The window stays small
+ * enough to be parsed from L2; the kernel is asked to read PREFETCH_AHEAD
+ * windows further into the page cache, so the disk keeps working while
+ * the caller consumes this one. Any other read drops the window and
+ * returns false; the caller then reads through the caches.
+ */
+bool tableiter::readAhead(uint64_t offset, uint32_t len, std::string_view &out) const {
+    if (offset >= ra.offset && offset + len <= ra.offset + ra.buf.size()) {
+        out = std::string_view(ra.buf).substr(offset - ra.offset, len);
+        return true;
+    }
+    if (!store->readaheadOn || offset < ra.next || offset - ra.next > ra.window) { // 不是顺序读
+        ra.window = 0;
+        ra.hinted = 0;
+        ra.buf.clear();
+        return false;
+    }
+    ra.window    = ra.window ? std::min(ra.window * 2, READAHEAD_MAX) : READAHEAD_MIN;
+    uint64_t end = std::min(dataEnd(), offset + std::max(ra.window, len));
+    if (end < offset + len)
+        return false;
+    ra.buf.resize(end - offset);
+    if (!store->tableCache.read(table->getFilename(), offset, end - offset, &ra.buf[0])) {
+        ra.window = 0;
+        ra.hinted = 0;
+        ra.buf.clear();
+        return false;
+    }
+    ra.offset     = offset;
+    uint64_t hint = std::min(dataEnd(), end + (uint64_t)ra.window * PREFETCH_AHEAD);
+    if (hint > std::max(ra.hinted, end)) { // 只提示新的部分，已经提示过的不再重复
+        uint64_t from = std::max(ra.hinted, end);
+        store->tableCache.prefetch(table->getFilename(), from, hint - from);
+        ra.hinted = hint;
+    }
+    out = std::string_view(ra.buf).substr(0, len);
+    return true;
+}
+
+uint64_t tableiter::dataEnd() const {
+    if (table->getVersion() < 2)
+        return table->getDataEnd();
+    blockIndex last = table->getBlock(table->getBlockCnt() - 1);
+    return last.offset + last.size;
+}
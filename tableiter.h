@@ -0,0 +1,62 @@
+#pragma once
+
+#ifndef LSM_KV_TABLEITER_H
+#define LSM_KV_TABLEITER_H
+
+#include "block.h"
+#include "blockcache.h"
+#include "sstablehead.h"
+
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+
+class KVStore;
+
+const uint32_t READAHEAD_MIN = 32 * 1024;   // 发现顺序读之后第一次预读的大小
+const uint32_t READAHEAD_MAX = 128 * 1024; // 之后每次预读翻倍，最多这么大（还能留在 L2 里）
+const uint32_t PREFETCH_AHEAD = 8;         // 让内核在后台提前读入几个预读窗口
+
+// 按 key 顺序遍历一张 sstable，v1 和 v2 格式都可以；value 通过 KVStore 的缓存读取
+class tableiter {
+private:
+    KVStore *store;
+    tableHandle table;
+    int pos = 0;                   // v1: 当前 key 的下标；v2: 当前数据块
+    blockHandle block;             // v2: 当前数据块，iter 指向它的内容；从预读缓冲读出时为空
+    std::optional<blockiter> iter; // v2: 块内的位置
+
+    // 向后遍历时数据是连续读的：一次读入一大段放在这里，不经过块缓存
+    struct readahead {
+        uint64_t offset = 0; // buf 在文件中的起点
+        std::string buf;
+        uint64_t next   = UINT64_MAX; // 上一次读到的位置，下一次从这里附近开始就是顺序读
+        uint32_t window = 0;          // 当前预读大小，0 表示还没有发现顺序读
+        uint64_t hinted = 0;          // 已经让内核开始读的位置
+    };
+    mutable readahead ra;
+
+    bool loadBlock(const blockHandle &loaded = nullptr); // v2: 读入第 pos 块，loaded 是调用者已经读好的
+    bool readAhead(uint64_t offset, uint32_t len, std::string_view &out) const; // 顺序读时指向预读缓冲，否则返回 false
+    uint64_t dataEnd() const;                                              // 数据区的结束位置
+
+public:
+    tableiter(KVStore *store, const tableHandle &table);
+
+    void seek(uint64_t key, const blockHandle &loaded = nullptr); // 第一个 >= key 的记录，loaded 是已读好的所在块
+    void seekToFirst();
+    void seekToLast();
+    void next();
+    void prev();
+    bool valid() const;
+    uint64_t key() const;
+    std::string value() const;
+    std::string_view valueView(std::string &scratch) const; // v2 指向当前块；v1 读进 scratch
+
+    const sstablehead &getTable() const {
+        return *table;
+    }
+};
+
+#endif // LSM_KV_TABLEITER_H
@@ -0,0 +1,29 @@
+#pragma once
+
+#ifndef LSM_KV_TABLESET_H
+#define LSM_KV_TABLESET_H
+
+#include "skiplist.h"
+#include "sstablehead.h"
+
+#include <memory>
+#include <vector>
+
+/*
+ * store 某一时刻的一个版本：memtable、它当时的范围删除和每层的 sstable。
+ * 装入之后不再修改，用 shared_ptr 共享。flush、compaction 和范围删除装入新的版本，
+ * 读者原子地取走当前版本，之后一直读这一份，不用加锁，也不怕写线程同时换掉它。
+ * memtable 还会被写线程继续插入（跳表允许并发读），但在版本释放之前不会被释放。
+ * 被 compaction 换掉的 sstable 文件已经删除，fd 固定在表缓存里，直到没有版本引用它。
+ */
+struct tableset {
+    std::shared_ptr<skiplist> mem;
+    std::shared_ptr<const std::vector<rangeDel>> memRanges; // 装入时 memtable 的范围删除
+    std::vector<std::vector<tableHandle>> levels;           // 同 sstableIndex，最后一个是最深的一层
+
+    int top() const { // 最深的一层，没有 sstable 时为 -1
+        return (int)levels.size() - 1;
+    }
+};
+
+#endif // LSM_KV_TABLESET_H
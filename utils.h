@@ -14,6 +14,7 @@
 #if defined(__linux__) || defined(__MINGW32__) || defined(__APPLE__)
 #include <cstring>
 #include <dirent.h>
+#include <fcntl.h>
 #include <unistd.h>
 #endif
 
@@ -137,4 +138,23 @@ static inline int rmfile(const char *path) {
 #endif
 }
 
+/**
+ * Flush a directory's entries to disk, so that files created or deleted
+ * in it survive a power loss
+ * @param path directory to be synced.
+ * @return 0 if synced successfully, -1 otherwise.
+ */
+static inline int syncDir(const char *path) {
+#ifdef _WIN32
+    return 0;
+#else
+    int fd = ::open(path, O_RDONLY | O_DIRECTORY);
+    if (fd < 0)
+        return -1;
+    int ret = ::fsync(fd);
+    ::close(fd);
+    return ret;
+#endif
+}
+
 } // namespace utils
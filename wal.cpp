@@ -0,0 +1,152 @@
+#include "wal.h"
+
+#include "MurmurHash3.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <iostream>
+#include <unistd.h>
+#include <vector>
+
+static uint32_t checksum(const char *p, uint32_t len) {
+    uint32_t h[4];
+    MurmurHash3_x64_128(p, len, 0x3c6ef372, h);
+    return h[0];
+}
+
+static void putU32(std::string &rep, size_t pos, uint32_t v) {
+    std::memcpy(&rep[pos], &v, 4);
+}
+
+void wal::record::add(uint8_t type, uint64_t key, const std::string &val) {
+    uint32_t len = val.length();
+    rep.append(reinterpret_cast<const char *>(&type), 1);
+    rep.append(reinterpret_cast<const char *>(&key), 8);
+    rep.append(reinterpret_cast<const char *>(&len), 4);
+    rep.append(val);
+    cnt++;
+}
+
+const std::string &wal::record::seal() {
+    putU32(rep, 4, rep.length() - 8); // payload = cnt + 条目
+    putU32(rep, 8, cnt);
+    putU32(rep, 0, checksum(rep.data() + 8, rep.length() - 8));
+    return rep;
+}
+
+wal::wal(const std::string &path) : path(path) {
+    fd = ::open(path.data(), O_RDWR | O_CREAT | O_APPEND, 0664);
+    if (fd < 0) {
+        std::cerr << "Error: Unable to open wal " << path << ": " << strerror(errno) << std::endl;
+    }
+}
+
+wal::~wal() {
+    if (fd >= 0)
+        ::close(fd);
+}
+
+void wal::setMode(SYNCMODE mode) {
+    std::lock_guard<std::mutex> lock(mtx);
+    this->mode = mode;
+}
+
+void wal::writeAll(const std::string &rep) {
+    size_t done = 0;
+    while (done < rep.length()) { // write 可能只写了一部分
+        ssize_t n = ::write(fd, rep.data() + done, rep.length() - done);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            std::cerr << "Error: wal write failed: " << strerror(errno) << std::endl;
+            break;
+        }
+        done += n;
+    }
+}
+
+uint64_t wal::append(record &rec) {
+    const std::string &rep = rec.seal();
+    std::lock_guard<std::mutex> lock(mtx);
+    writeAll(rep);
+    return ++lastSeq;
+}
+
+void wal::sync(uint64_t seq) {
+    std::unique_lock<std::mutex> lock(mtx);
+    if (mode == SYNC_NONE)
+        return;
+    if (mode == SYNC_EVERY) {
+        if (syncedSeq < seq) {
+            ::fdatasync(fd);
+            syncedSeq = lastSeq;
+        }
+        return;
+    }
+    // 组提交：第一个到达的写者成为 leader，一次 fdatasync 覆盖它之前写入的所有记录，
+    // 其余写者等待，直到自己的记录被某次 sync 覆盖
+    while (syncedSeq < seq) {
+        if (syncing) {
+            cv.wait(lock);
+            continue;
+        }
+        syncing         = true;
+        uint64_t target = lastSeq;
+        lock.unlock();
+        ::fdatasync(fd);
+        lock.lock();
+        syncing   = false;
+        syncedSeq = std::max(syncedSeq, target);
+        cv.notify_all();
+    }
+}
+
+void wal::truncate(uint64_t epoch) {
+    std::lock_guard<std::mutex> lock(mtx);
+    if (::ftruncate(fd, 0) != 0) {
+        std::cerr << "Error: wal truncate failed: " << strerror(errno) << std::endl;
+        return;
+    }
+    record rec;
+    rec.add(OP_EPOCH, epoch, "");
+    writeAll(rec.seal());
+    if (mode != SYNC_NONE)
+        ::fdatasync(fd);
+    syncedSeq = lastSeq;
+}
+
+void wal::replay(const std::function<void(uint8_t, uint64_t, const std::string &)> &apply) {
+    std::lock_guard<std::mutex> lock(mtx);
+    off_t size = ::lseek(fd, 0, SEEK_END);
+    if (size <= 0)
+        return;
+    std::vector<char> buf(size);
+    if (::pread(fd, buf.data(), size, 0) != size) {
+        std::cerr << "Error: wal read failed: " << strerror(errno) << std::endl;
+        return;
+    }
+    off_t pos = 0;
+    while (pos + 12 <= size) {
+        uint32_t sum, len, cnt;
+        std::memcpy(&sum, &buf[pos], 4);
+        std::memcpy(&len, &buf[pos + 4], 4);
+        if (len < 4 || pos + 8 + len > size || checksum(&buf[pos + 8], len) != sum)
+            break; // 尾部不完整的记录，崩溃时没有写完
+        std::memcpy(&cnt, &buf[pos + 8], 4);
+        off_t p = pos + 12;
+        for (uint32_t i = 0; i < cnt; ++i) {
+            uint8_t type = buf[p];
+            uint64_t key;
+            uint32_t vlen;
+            std::memcpy(&key, &buf[p + 1], 8);
+            std::memcpy(&vlen, &buf[p + 9], 4);
+            apply(type, key, std::string(&buf[p + 13], vlen));
+            p += 13 + vlen;
+        }
+        pos += 8 + len;
+    }
+    if (pos < size) // 丢弃残缺的尾部，之后的追加从干净的位置开始
+        ::ftruncate(fd, pos);
+}
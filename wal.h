@@ -0,0 +1,85 @@
+#pragma once
+
+#ifndef LSM_KV_WAL_H
+#define LSM_KV_WAL_H
+
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+
+enum SYNCMODE {
+    SYNC_NONE,  // 只写入页缓存，进程崩溃(kill -9)不丢数据，掉电可能丢
+    SYNC_EVERY, // 每条记录单独 fdatasync
+    SYNC_GROUP  // 组提交：并发写者共享一次 fdatasync
+};
+
+/*
+ * 预写日志(write-ahead log)，只追加。
+ * 一条记录的格式: | checksum(4) | payload长度(4) | payload |
+ * payload 由若干条目组成: | cnt(4) | { type(1) | key(8) | len(4) | value } * cnt |
+ * 一条记录要么整体重放，要么整体丢弃（尾部被截断或校验失败）。
+ * 清空之后的第一条记录是 OP_EPOCH，记下清空时最新的 sstable 时间戳：
+ * 如果 0 层有比它新的表，说明日志里的写入已经 flush 过，只是还没来得及清空。
+ */
+class wal {
+private:
+    int fd = -1;
+    std::string path;
+    SYNCMODE mode = SYNC_NONE;
+
+    std::mutex mtx;
+    std::condition_variable cv;
+    uint64_t lastSeq   = 0; // 已经写入的最后一条记录序号
+    uint64_t syncedSeq = 0; // 已经落盘的最后一条记录序号
+    bool syncing       = false;
+
+    void writeAll(const std::string &rep); // 调用方持有 mtx
+
+public:
+    enum OPTYPE : uint8_t {
+        OP_PUT      = 1,
+        OP_DEL      = 2,
+        OP_DELRANGE = 3, // key 为区间起点，value 为 8 字节的区间终点
+        OP_MERGE    = 4, // value 为 merge 操作数
+        OP_EPOCH    = 5  // key 为清空日志时的 sstable 时间戳
+    };
+
+    // 一条待写入的记录，可以包含多个条目（WriteBatch 就是一条记录）
+    class record {
+    private:
+        std::string rep;
+        uint32_t cnt = 0;
+
+    public:
+        record() {
+            rep.assign(12, '\0'); // checksum, len, cnt 在 seal 时补上
+        }
+
+        void add(uint8_t type, uint64_t key, const std::string &val);
+        const std::string &seal();
+
+        uint32_t getCnt() const {
+            return cnt;
+        }
+    };
+
+    wal(const std::string &path);
+    ~wal();
+
+    void setMode(SYNCMODE mode);
+
+    SYNCMODE getMode() const {
+        return mode;
+    }
+
+    uint64_t append(record &rec);  // 写入一条记录，返回它的序号（此时不保证落盘）
+    void sync(uint64_t seq);       // 按照 mode 保证 seq 之前的记录落盘
+    void truncate(uint64_t epoch); // memtable 落盘后清空日志，写入新的 OP_EPOCH
+
+    // 按写入顺序重放所有完整的记录
+    void replay(const std::function<void(uint8_t, uint64_t, const std::string &)> &apply);
+};
+
+#endif // LSM_KV_WAL_H
@@ -0,0 +1,58 @@
+#pragma once
+
+#ifndef LSM_KV_WRITEBATCH_H
+#define LSM_KV_WRITEBATCH_H
+
+#include "skiplist.h"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/*
+ * 一组需要原子生效的写操作，由 KVStore::write 一次性应用：
+ * 只写一条 WAL 记录，只做一次 memtable 大小检查。
+ * 同一个 key 多次出现时，后面的操作覆盖前面的。
+ * 整批必须能放进一张 level-0 sstable（2MB，含表头和过滤器），否则 write 拒绝整批、返回 false；
+ * 更大的写入请分成几批。
+ * 并发的 get 和 multi_get 要么看到整批，要么都看不到；不在快照上的迭代器读的是移动时的数据，
+ * 可能在一批的中间跨过去，要固定的视图请用快照。
+ */
+class WriteBatch {
+    friend class KVStore;
+
+private:
+    struct entry {
+        bool isDel;
+        uint64_t key;
+        std::string value;
+
+        entry(bool isDel, uint64_t key, const std::string &value) : isDel(isDel), key(key), value(value) {}
+    };
+
+    std::vector<entry> entries;
+    uint32_t bytes = 0; // 全部写入 memtable 后最多增加的字节数
+
+public:
+    void put(uint64_t key, const std::string &val) {
+        entries.emplace_back(false, key, val);
+        bytes += 12 + val.length();
+    }
+
+    // 不读旧值，直接写入删除标记
+    void del(uint64_t key) {
+        entries.emplace_back(true, key, DEL);
+        bytes += 12 + DEL.length();
+    }
+
+    void clear() {
+        entries.clear();
+        bytes = 0;
+    }
+
+    size_t count() const {
+        return entries.size();
+    }
+};
+
+#endif // LSM_KV_WRITEBATCH_H
@@ -0,0 +1,119 @@
+#include "xorfilter.h"
+
+#include <algorithm>
+#include <cstring>
+
+static const uint32_t XOR_HEADER = 16;
+
+static uint64_t mix(uint64_t h) { // murmur3 的 64 位收尾
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccd;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53;
+    h ^= h >> 33;
+    return h;
+}
+
+static uint32_t reduce(uint32_t x, uint32_t n) { // 把 x 均匀映射到 [0, n)
+    return ((uint64_t)x * n) >> 32;
+}
+
+static uint64_t rotl(uint64_t x, int r) {
+    return (x << r) | (x >> (64 - r));
+}
+
+static uint8_t fingerprint(uint64_t h) {
+    return h ^ (h >> 32);
+}
+
+static void positions(uint64_t h, uint32_t blockLength, uint32_t p[3]) {
+    p[0] = reduce(h, blockLength);
+    p[1] = reduce(rotl(h, 21), blockLength) + blockLength;
+    p[2] = reduce(rotl(h, 42), blockLength) + 2 * blockLength;
+}
+
+static uint32_t blockLengthFor(uint64_t keys) {
+    return (32 + (keys * 123 + 99) / 100) / 3; // 容量 1.23n + 32，分三段
+}
+
+uint32_t xorBytes(uint64_t keys) {
+    return XOR_HEADER + 3 * blockLengthFor(keys);
+}
+
+void xorBuild(std::vector<uint64_t> hashes, char *out) {
+    std::sort(hashes.begin(), hashes.end()); // 重复的哈希会让剥离永远失败
+    hashes.erase(std::unique(hashes.begin(), hashes.end()), hashes.end());
+    uint32_t blockLength = blockLengthFor(hashes.size()), capacity = 3 * blockLength;
+    std::vector<uint8_t> count(capacity);
+    std::vector<uint64_t> xorHash(capacity);
+    std::vector<uint32_t> queue;
+    std::vector<std::pair<uint64_t, uint32_t>> stack; // 剥离顺序: (哈希, 它独占的位置)
+    uint64_t seed = 0;
+    for (;; ++seed) {
+        std::fill(count.begin(), count.end(), 0);
+        std::fill(xorHash.begin(), xorHash.end(), 0);
+        queue.clear();
+        stack.clear();
+        uint32_t p[3];
+        for (uint64_t key : hashes) {
+            uint64_t h = mix(key + seed);
+            positions(h, blockLength, p);
+            for (uint32_t i : p) {
+                count[i]++;
+                xorHash[i] ^= h;
+            }
+        }
+        for (uint32_t i = 0; i < capacity; ++i) {
+            if (count[i] == 1)
+                queue.push_back(i);
+        }
+        while (!queue.empty()) { // 反复摘掉只被一个 key 占用的位置
+            uint32_t i = queue.back();
+            queue.pop_back();
+            if (count[i] != 1)
+                continue;
+            uint64_t h = xorHash[i];
+            stack.emplace_back(h, i);
+            positions(h, blockLength, p);
+            for (uint32_t j : p) {
+                count[j]--;
+                xorHash[j] ^= h;
+                if (count[j] == 1)
+                    queue.push_back(j);
+            }
+        }
+        if (stack.size() == hashes.size())
+            break; // 全部剥离成功，否则换一个 seed 重来
+    }
+    std::memcpy(out, &seed, 8);
+    std::memcpy(out + 8, &blockLength, 4);
+    uint8_t *fp = reinterpret_cast<uint8_t *>(out + XOR_HEADER);
+    for (size_t k = stack.size(); k-- > 0;) { // 逆序赋值，每个位置只在最后被它的 key 决定
+        uint64_t h = stack[k].first;
+        uint32_t i = stack[k].second, p[3];
+        positions(h, blockLength, p);
+        fp[i] = 0;
+        fp[i] = fingerprint(h) ^ fp[p[0]] ^ fp[p[1]] ^ fp[p[2]];
+    }
+}
+
+bool xorContain(const char *filter, uint64_t hash) {
+    uint64_t seed;
+    uint32_t blockLength, p[3];
+    std::memcpy(&seed, filter, 8);
+    std::memcpy(&blockLength, filter + 8, 4);
+    const uint8_t *fp = reinterpret_cast<const uint8_t *>(filter + XOR_HEADER);
+    uint64_t h        = mix(hash + seed);
+    positions(h, blockLength, p);
+    return fingerprint(h) == (fp[p[0]] ^ fp[p[1]] ^ fp[p[2]]);
+}
+
+void xorPrefetch(const char *filter, uint64_t hash) {
+    uint64_t seed;
+    uint32_t blockLength, p[3];
+    std::memcpy(&seed, filter, 8);
+    std::memcpy(&blockLength, filter + 8, 4);
+    positions(mix(hash + seed), blockLength, p);
+    for (uint32_t i : p)
+        __builtin_prefetch(filter + XOR_HEADER + i);
+}
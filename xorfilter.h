@@ -0,0 +1,24 @@
+#pragma once
+
+#ifndef LSM_KV_XORFILTER_H
+#define LSM_KV_XORFILTER_H
+
+#include <cstdint>
+#include <vector>
+
+/*
+ * Xor8 静态过滤器：一次建好所有 key，之后只读，每个 key 约 9.84 位，假阳性率约 1/256。
+ * 每个 key 映射到三段中各一个字节，三个字节异或等于它的 8 位指纹。
+ * 布局: | seed(8) | blockLength(4) | 0(4) | fingerprints(3 * blockLength) |
+ * 这里的 hash 是 key 的 64 位哈希（keyHash.h[0]），查询时不再重新哈希 key。
+ */
+
+uint32_t xorBytes(uint64_t keys); // keys 个 key 需要的字节数
+
+void xorBuild(std::vector<uint64_t> hashes, char *out); // out 至少 xorBytes(hashes.size()) 字节，要先清零
+
+bool xorContain(const char *filter, uint64_t hash);
+
+void xorPrefetch(const char *filter, uint64_t hash);
+
+#endif // LSM_KV_XORFILTER_H